@@ -1,27 +1,19 @@
 #ifndef CONTROLLER_H
 #define CONTROLLER_H
 
-#include <gpiod.hpp>
 #include <iostream>
 #include <thread>
 #include <chrono>
-#include <atomic>
 #include <stdexcept>
 
+#include "PwmScheduler.h"
+#include "Telemetry.h"
+
 class Controller {
 private:
-    gpiod::chip* chip;
-    gpiod::line_request* request;
-    
-    std::atomic<bool> running;
-    std::thread pwm_thread;
-    std::atomic<int> pulse_width_us;
+    PwmScheduler* scheduler;
     unsigned int gpio_pin;
-
-    const int PWM_PERIOD_US = 20000;
-
-    // Declaration only
-    void pwmLoop(); 
+    Telemetry::Source telemetry_source;
     
 public:
     // Declarations only
@@ -32,10 +24,17 @@ public:
     Controller(const Controller&) = delete;
     Controller& operator=(const Controller&) = delete;
 
-    bool initialize(unsigned int pin, const char *chip_path = "/dev/gpiochip4");
+    bool initialize(unsigned int pin, const char *chip_path = "/dev/gpiochip4",
+                    GpioBackend &backend = GpioBackend::defaultBackend());
     void setSpeed(int speed_percent);
     void stop();
     void cleanup();
+
+    // Measured pulse width error of this servo's channel
+    PwmScheduler::ChannelStats getPulseStats() const;
+
+    // Set by Telemetry::Recorder::add, commands are recorded under this source
+    void setTelemetrySource(Telemetry::Source source) { telemetry_source = source; }
 };
 
 #endif // CONTROLLER_H
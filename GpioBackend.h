@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Time source for anything scheduled against absolute deadlines
+class Clock {
+    public:
+        virtual ~Clock() = default;
+
+        virtual uint64_t nowNs() = 0;
+        // Returns at or after deadline_ns, busy-waiting the last spin_ns where that means anything
+        virtual void sleepUntilNs(uint64_t deadline_ns, uint64_t spin_ns = 0) = 0;
+};
+
+// A set of lines requested together from one chip
+class GpioLines {
+    public:
+        struct Edge {
+            bool rising;
+            uint64_t timestamp_ns; // On the backend's clock
+        };
+
+        // Line offset and whether it is driven active
+        using Values = std::vector<std::pair<unsigned int, bool>>;
+
+        virtual ~GpioLines() = default;
+
+        virtual void setValue(unsigned int offset, bool active) = 0;
+        // All lines change in one write
+        virtual void setValues(const Values &values) = 0;
+        virtual bool getValue(unsigned int offset) = 0;
+
+        // Edge events, for lines requested with detect_edges. fd() is readable while any are pending
+        virtual int fd() const = 0;
+        virtual bool waitEdges(std::chrono::nanoseconds timeout) = 0;
+        virtual size_t readEdges(std::vector<Edge> &edges) = 0;
+};
+
+// Where the device classes get their lines and their clock: libgpiod and CLOCK_MONOTONIC
+// by default, or a GpioSimulator so motion can be checked without hardware or real time.
+class GpioBackend : public Clock {
+    public:
+        struct LineConfig {
+            std::vector<unsigned int> offsets;
+            bool output = true;
+            bool initial_active = false; // Outputs only
+            bool detect_edges = false; // Inputs only, both edges
+            size_t event_buffer_size = 64;
+            std::vector<unsigned int> active_offsets = {}; // Outputs only, start active whatever initial_active says
+        };
+
+        // Throws like libgpiod does when the lines can't be requested
+        virtual std::unique_ptr<GpioLines> request(const std::string &chip_path, const std::string &consumer,
+                                                   const LineConfig &config) = 0;
+
+        // The backend devices use unless given another, the libgpiod one until replaced
+        static GpioBackend &defaultBackend();
+        // nullptr restores libgpiod. Only affects devices created afterwards
+        static void setDefault(GpioBackend *backend);
+};
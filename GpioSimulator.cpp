@@ -0,0 +1,266 @@
+#include "GpioSimulator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <deque>
+#include <stdexcept>
+#include <system_error>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+class GpioSimulator::Lines : public GpioLines {
+    public:
+        Lines(GpioSimulator &simulator, const std::string &chip_path, const LineConfig &config)
+            : _simulator(simulator),
+              _chip_path(chip_path),
+              _offsets(config.offsets),
+              _output(config.output),
+              _detect_edges(!config.output && config.detect_edges),
+              _event_buffer_size(std::max<size_t>(config.event_buffer_size, 1)),
+              _event_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+        {
+            if (_event_fd == -1) {
+                throw std::system_error(errno, std::generic_category(), "eventfd");
+            }
+        }
+
+        ~Lines() override {
+            std::lock_guard<std::mutex> lock(_simulator._mutex);
+
+            for (unsigned int offset : _offsets) {
+                _simulator._lines[{_chip_path, offset}].owner = nullptr;
+            }
+
+            close(_event_fd);
+        }
+
+        void setValue(unsigned int offset, bool active) override {
+            std::lock_guard<std::mutex> lock(_simulator._mutex);
+            _simulator.change(_chip_path, offset, writable(offset), active);
+        }
+
+        void setValues(const Values &values) override {
+            std::lock_guard<std::mutex> lock(_simulator._mutex);
+
+            for (const auto &value : values) {
+                writable(value.first);
+            }
+
+            for (const auto &value : values) {
+                _simulator.change(_chip_path, value.first, _simulator._lines[{_chip_path, value.first}], value.second);
+            }
+        }
+
+        bool getValue(unsigned int offset) override {
+            std::lock_guard<std::mutex> lock(_simulator._mutex);
+            return line(offset).active;
+        }
+
+        int fd() const override {
+            return _event_fd;
+        }
+
+        // Waits in real time, edges only arrive from drive()
+        bool waitEdges(std::chrono::nanoseconds timeout) override {
+            {
+                std::lock_guard<std::mutex> lock(_simulator._mutex);
+                if (!_events.empty()) {
+                    return true;
+                }
+            }
+
+            pollfd descriptor = {_event_fd, POLLIN, 0};
+            int timeout_ms = (int)std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+            return poll(&descriptor, 1, timeout_ms) > 0;
+        }
+
+        size_t readEdges(std::vector<Edge> &edges) override {
+            std::lock_guard<std::mutex> lock(_simulator._mutex);
+
+            size_t count = std::min(_events.size(), _event_buffer_size);
+            edges.insert(edges.end(), _events.begin(), _events.begin() + count);
+            _events.erase(_events.begin(), _events.begin() + count);
+
+            if (_events.empty()) {
+                uint64_t drained;
+                ssize_t got = read(_event_fd, &drained, sizeof(drained));
+                (void)got;
+            }
+
+            return count;
+        }
+
+        // Caller holds the simulator's mutex
+        void queueEdge(const Edge &edge) {
+            if (!_detect_edges) {
+                return;
+            }
+
+            _events.push_back(edge);
+
+            uint64_t wake = 1;
+            ssize_t written = write(_event_fd, &wake, sizeof(wake));
+            (void)written;
+        }
+
+    private:
+        GpioSimulator &_simulator;
+        std::string _chip_path;
+        std::vector<unsigned int> _offsets;
+        bool _output;
+        bool _detect_edges;
+        size_t _event_buffer_size;
+        int _event_fd;
+        std::deque<Edge> _events;
+
+        Line &line(unsigned int offset) {
+            if (std::find(_offsets.begin(), _offsets.end(), offset) == _offsets.end()) {
+                throw std::invalid_argument("line " + std::to_string(offset) + " is not part of this request");
+            }
+
+            return _simulator._lines[{_chip_path, offset}];
+        }
+
+        Line &writable(unsigned int offset) {
+            Line &requested = line(offset);
+
+            if (!_output) {
+                throw std::system_error(EPERM, std::generic_category(), "line " + std::to_string(offset) + " is an input");
+            }
+
+            return requested;
+        }
+};
+
+GpioSimulator::GpioSimulator(uint64_t start_ns, ClockMode mode, size_t edge_capacity)
+    : _now_ns(start_ns),
+      _mode(mode),
+      _edge_capacity(std::max<size_t>(edge_capacity, 1))
+{}
+
+GpioSimulator::~GpioSimulator() = default;
+
+std::unique_ptr<GpioLines> GpioSimulator::request(const std::string &chip_path, const std::string &,
+                                                  const LineConfig &config) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    for (unsigned int offset : config.offsets) {
+        auto line = _lines.find({chip_path, offset});
+
+        if (line != _lines.end() && line->second.owner) {
+            throw std::system_error(EBUSY, std::generic_category(), chip_path + " line " + std::to_string(offset));
+        }
+    }
+
+    auto lines = std::make_unique<Lines>(*this, chip_path, config);
+
+    for (unsigned int offset : config.offsets) {
+        Line &line = _lines[{chip_path, offset}];
+        line.owner = lines.get();
+
+        if (config.output) {
+            bool active = config.initial_active || std::find(config.active_offsets.begin(), config.active_offsets.end(),
+                                                             offset) != config.active_offsets.end();
+            change(chip_path, offset, line, active);
+        }
+    }
+
+    return lines;
+}
+
+uint64_t GpioSimulator::nowNs() {
+    return _now_ns;
+}
+
+void GpioSimulator::sleepUntilNs(uint64_t deadline_ns, uint64_t) {
+    if (_mode == ClockMode::STEPPED) {
+        std::unique_lock<std::mutex> lock(_clock_mutex);
+        _clock_cv.wait(lock, [&] { return _now_ns >= deadline_ns || _mode != ClockMode::STEPPED; });
+
+        if (_now_ns >= deadline_ns) {
+            return;
+        }
+    }
+
+    uint64_t now = _now_ns;
+
+    while (now < deadline_ns && !_now_ns.compare_exchange_weak(now, deadline_ns)) {}
+}
+
+void GpioSimulator::advance(std::chrono::nanoseconds duration) {
+    {
+        std::lock_guard<std::mutex> lock(_clock_mutex);
+        _now_ns += duration.count();
+    }
+    _clock_cv.notify_all();
+}
+
+void GpioSimulator::setClockMode(ClockMode mode) {
+    {
+        std::lock_guard<std::mutex> lock(_clock_mutex);
+        _mode = mode;
+    }
+    _clock_cv.notify_all();
+}
+
+void GpioSimulator::drive(const std::string &chip_path, unsigned int offset, bool active) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    change(chip_path, offset, _lines[{chip_path, offset}], active);
+}
+
+bool GpioSimulator::value(const std::string &chip_path, unsigned int offset) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto line = _lines.find({chip_path, offset});
+    return line != _lines.end() && line->second.active;
+}
+
+std::vector<GpioSimulator::RecordedEdge> GpioSimulator::edges() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return std::vector<RecordedEdge>(_edges.begin(), _edges.end());
+}
+
+std::vector<GpioSimulator::RecordedEdge> GpioSimulator::edges(const std::string &chip_path, unsigned int offset) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::vector<RecordedEdge> line_edges;
+    for (const RecordedEdge &edge : _edges) {
+        if (edge.offset == offset && edge.chip_path == chip_path) {
+            line_edges.push_back(edge);
+        }
+    }
+
+    return line_edges;
+}
+
+void GpioSimulator::clearEdges() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _edges.clear();
+    _dropped_edges = 0;
+}
+
+uint64_t GpioSimulator::droppedEdges() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _dropped_edges;
+}
+
+void GpioSimulator::change(const std::string &chip_path, unsigned int offset, Line &line, bool active) {
+    if (line.active == active) {
+        return;
+    }
+
+    line.active = active;
+
+    uint64_t now = _now_ns;
+
+    if (_edges.size() == _edge_capacity) {
+        _edges.pop_front();
+        _dropped_edges++;
+    }
+    _edges.push_back({chip_path, offset, active, now});
+
+    if (line.owner) {
+        line.owner->queueEdge({active, now});
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "GpioBackend.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+
+// In-memory GPIO on a virtual clock. Every change of a line is recorded with the virtual
+// time it happened at, so long moves and their timing can be checked in milliseconds
+// without hardware.
+//
+// The clock runs in one of two modes:
+//  - FREE_RUNNING: sleeps return at once and move the clock forward to their deadline. Suits
+//    one timing thread that finishes on its own, a StepperController or StepperGroup move.
+//    A servo's PwmScheduler never finishes and would run the clock away, and several timing
+//    threads push the clock under each other, so those need STEPPED.
+//  - STEPPED: only advance() moves the clock, sleeps block until it reaches their deadline.
+//    Any mix of devices can run; the test paces them. Threads asleep on the clock must be
+//    woken, by advancing or switching to FREE_RUNNING, before their devices are destroyed.
+//
+// The edge log keeps the newest edge_capacity edges.
+class GpioSimulator : public GpioBackend {
+    public:
+        enum class ClockMode {
+            FREE_RUNNING,
+            STEPPED
+        };
+
+        static constexpr size_t DEFAULT_EDGE_CAPACITY = 1 << 20;
+
+        struct RecordedEdge {
+            std::string chip_path;
+            unsigned int offset;
+            bool active; // The level the line changed to
+            uint64_t time_ns;
+        };
+
+        explicit GpioSimulator(uint64_t start_ns = 0, ClockMode mode = ClockMode::FREE_RUNNING,
+                               size_t edge_capacity = DEFAULT_EDGE_CAPACITY);
+        // Every request must have been released first
+        ~GpioSimulator();
+
+        GpioSimulator(const GpioSimulator&) = delete;
+        GpioSimulator& operator=(const GpioSimulator&) = delete;
+
+        std::unique_ptr<GpioLines> request(const std::string &chip_path, const std::string &consumer,
+                                           const LineConfig &config) override;
+
+        uint64_t nowNs() override;
+        void sleepUntilNs(uint64_t deadline_ns, uint64_t spin_ns = 0) override;
+        void advance(std::chrono::nanoseconds duration);
+        // Switching to FREE_RUNNING releases every blocked sleeper
+        void setClockMode(ClockMode mode);
+
+        // Sets an input line from outside, as the wiring would, queueing edges for requests watching it
+        void drive(const std::string &chip_path, unsigned int offset, bool active);
+        bool value(const std::string &chip_path, unsigned int offset) const;
+
+        // Changes of every line, outputs and driven inputs, in the order they happened
+        std::vector<RecordedEdge> edges() const;
+        std::vector<RecordedEdge> edges(const std::string &chip_path, unsigned int offset) const;
+        void clearEdges();
+        // Edges dropped from the log to keep it within capacity
+        uint64_t droppedEdges() const;
+
+    private:
+        class Lines;
+        friend class Lines;
+
+        struct Line {
+            bool active = false;
+            Lines *owner = nullptr;
+        };
+
+        std::atomic<uint64_t> _now_ns;
+        std::atomic<ClockMode> _mode;
+        std::mutex _clock_mutex;
+        std::condition_variable _clock_cv;
+
+        mutable std::mutex _mutex;
+        std::map<std::pair<std::string, unsigned int>, Line> _lines;
+        std::deque<RecordedEdge> _edges;
+        size_t _edge_capacity;
+        uint64_t _dropped_edges = 0;
+
+        // Caller holds _mutex
+        void change(const std::string &chip_path, unsigned int offset, Line &line, bool active);
+};
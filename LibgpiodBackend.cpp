@@ -0,0 +1,149 @@
+#include "LibgpiodBackend.h"
+#include "Utils.h"
+
+#include <gpiod.hpp>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+namespace {
+    class LibgpiodLines : public GpioLines {
+        public:
+            LibgpiodLines(gpiod::line_request request, size_t event_buffer_size)
+                : _request(std::move(request)),
+                  _buffer(event_buffer_size)
+            {}
+
+            void setValue(unsigned int offset, bool active) override {
+                _request.set_value(offset, active ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE);
+            }
+
+            void setValues(const Values &values) override {
+                // The mapping is kept between calls so the hot path doesn't allocate
+                std::lock_guard<std::mutex> lock(_mappings_mutex);
+
+                _mappings.clear();
+                for (const auto &value : values) {
+                    _mappings.emplace_back(value.first, value.second ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE);
+                }
+
+                _request.set_values(_mappings);
+            }
+
+            bool getValue(unsigned int offset) override {
+                return _request.get_value(offset) == gpiod::line::value::ACTIVE;
+            }
+
+            int fd() const override {
+                return _request.fd();
+            }
+
+            bool waitEdges(std::chrono::nanoseconds timeout) override {
+                return _request.wait_edge_events(timeout);
+            }
+
+            size_t readEdges(std::vector<Edge> &edges) override {
+                size_t count = _request.read_edge_events(_buffer);
+
+                for (size_t i = 0; i < count; i++) {
+                    const gpiod::edge_event &event = _buffer.get_event(i);
+                    edges.push_back({event.type() == gpiod::edge_event::event_type::RISING_EDGE, event.timestamp_ns().ns()});
+                }
+
+                return count;
+            }
+
+        private:
+            gpiod::line_request _request;
+            gpiod::edge_event_buffer _buffer;
+
+            std::mutex _mappings_mutex;
+            gpiod::line::value_mappings _mappings;
+    };
+}
+
+std::unique_ptr<GpioLines> LibgpiodBackend::request(const std::string &chip_path, const std::string &consumer,
+                                                    const LineConfig &config) {
+    std::lock_guard<std::mutex> lock(_chips_mutex);
+
+    std::shared_ptr<gpiod::chip> &chip = _chips[chip_path];
+    if (!chip) {
+        try {
+            chip = std::make_shared<gpiod::chip>(chip_path);
+        } catch (...) {
+            _chips.erase(chip_path);
+            throw;
+        }
+    }
+
+    gpiod::line::offsets offsets;
+    gpiod::line::offsets active_offsets;
+    gpiod::line_settings settings;
+
+    for (unsigned int offset : config.offsets) {
+        bool active = config.output && std::find(config.active_offsets.begin(), config.active_offsets.end(), offset)
+                                       != config.active_offsets.end();
+        (active ? active_offsets : offsets).push_back(offset);
+    }
+
+    if (config.output) {
+        settings.set_direction(gpiod::line::direction::OUTPUT)
+                .set_output_value(config.initial_active ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE);
+    } else {
+        settings.set_direction(gpiod::line::direction::INPUT);
+
+        if (config.detect_edges) {
+            settings.set_edge_detection(gpiod::line::edge::BOTH)
+                    .set_event_clock(gpiod::line::clock::MONOTONIC);
+        }
+    }
+
+    gpiod::request_config request_config;
+    request_config.set_consumer(consumer)
+                  .set_event_buffer_size(config.event_buffer_size);
+
+    gpiod::request_builder builder = chip->prepare_request();
+    builder.set_request_config(request_config);
+
+    if (!offsets.empty()) {
+        builder.add_line_settings(offsets, settings);
+    }
+
+    if (!active_offsets.empty()) {
+        gpiod::line_settings active_settings = settings;
+        active_settings.set_output_value(gpiod::line::value::ACTIVE);
+        builder.add_line_settings(active_offsets, active_settings);
+    }
+
+    return std::make_unique<LibgpiodLines>(builder.do_request(), config.event_buffer_size);
+}
+
+size_t LibgpiodBackend::openChips() const {
+    std::lock_guard<std::mutex> lock(_chips_mutex);
+    return _chips.size();
+}
+
+uint64_t LibgpiodBackend::nowNs() {
+    return Utils::monotonicNs();
+}
+
+void LibgpiodBackend::sleepUntilNs(uint64_t deadline_ns, uint64_t spin_ns) {
+    if (deadline_ns > spin_ns) {
+        Utils::sleepUntilNs(deadline_ns - spin_ns);
+    }
+
+    while (Utils::monotonicNs() < deadline_ns) {}
+}
+
+static std::atomic<GpioBackend *> default_backend{nullptr};
+
+GpioBackend &GpioBackend::defaultBackend() {
+    static LibgpiodBackend libgpiod;
+
+    GpioBackend *backend = default_backend;
+    return backend ? *backend : libgpiod;
+}
+
+void GpioBackend::setDefault(GpioBackend *backend) {
+    default_backend = backend;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "GpioBackend.h"
+
+#include <map>
+#include <mutex>
+
+namespace gpiod {
+    class chip;
+}
+
+// Real GPIO through libgpiod, timed on CLOCK_MONOTONIC. Each chip is opened once and
+// shared by every request made on it.
+class LibgpiodBackend : public GpioBackend {
+    public:
+        std::unique_ptr<GpioLines> request(const std::string &chip_path, const std::string &consumer,
+                                           const LineConfig &config) override;
+
+        uint64_t nowNs() override;
+        void sleepUntilNs(uint64_t deadline_ns, uint64_t spin_ns = 0) override;
+
+        // Number of chips held open
+        size_t openChips() const;
+
+    private:
+        mutable std::mutex _chips_mutex;
+        std::map<std::string, std::shared_ptr<gpiod::chip>> _chips;
+};
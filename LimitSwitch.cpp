@@ -1,21 +1,201 @@
 #include "LimitSwitch.h"
+#include "StepperController.h"
+#include "RealTime.h"
+
+#include <algorithm>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static GpioBackend::LineConfig lineConfig(unsigned int pin) {
+    GpioBackend::LineConfig config;
+    config.offsets = {pin};
+    config.output = false;
+    config.detect_edges = true;
+    config.event_buffer_size = 64;
+    return config;
+}
 
 LimitSwitch::LimitSwitch(
     unsigned int pin, 
-    const std::string &chip_path)
-    : _chip(chip_path),
-      _pin(pin),
-      
-      _request(_chip.prepare_request()
-                .set_request_config(gpiod::request_config().set_consumer("limit_switch"))
-                .add_line_settings(
-                    pin,
-                    gpiod::line_settings()
-                        .set_direction(gpiod::line::direction::INPUT)
-                )
-                .do_request()) 
-{}
+    const std::string &chip_path,
+    std::chrono::microseconds debounce,
+    GpioBackend &backend)
+    : _pin(pin),
+      _clock(backend),
+      _lines(backend.request(chip_path, "limit_switch", lineConfig(pin))),
+      _debounce_ns(std::chrono::duration_cast<std::chrono::nanoseconds>(debounce).count()),
+      _watching(false),
+      _wake_fd(eventfd(0, EFD_CLOEXEC))
+{
+    _edges.reserve(64);
+    _triggered = get();
+    _raw_triggered = _triggered;
+}
+
+LimitSwitch::~LimitSwitch() {
+    if (_watching) {
+        _watching = false;
+
+        uint64_t wake = 1;
+        ssize_t written = write(_wake_fd, &wake, sizeof(wake));
+        (void)written;
+    }
+
+    if (_watcher.joinable()) {
+        _watcher.join();
+    }
+
+    if (_wake_fd != -1) {
+        close(_wake_fd);
+    }
+}
 
 bool LimitSwitch::get() {
-    return _request.get_value(_pin) == gpiod::line::value::INACTIVE;
-}
\ No newline at end of file
+    return !_lines->getValue(_pin);
+}
+
+int LimitSwitch::fd() const {
+    return _lines->fd();
+}
+
+bool LimitSwitch::waitForEdge(std::chrono::nanoseconds timeout) {
+    return _lines->waitEdges(timeout);
+}
+
+size_t LimitSwitch::readEvents(std::vector<Event> &events) {
+    size_t before = events.size();
+
+    // Reading with nothing queued blocks until the next edge
+    if (_lines->waitEdges(std::chrono::nanoseconds(0))) {
+        readEdges(events);
+    }
+
+    settleIfDue(events);
+    return events.size() - before;
+}
+
+uint64_t LimitSwitch::settleDeadlineNs() const {
+    return _settling ? _last_accepted_ns + _debounce_ns : 0;
+}
+
+// Caller has checked that edges are queued
+void LimitSwitch::readEdges(std::vector<Event> &events) {
+    _edges.clear();
+    _lines->readEdges(_edges);
+
+    for (const GpioLines::Edge &edge : _edges) {
+        bool triggered = !edge.rising;
+        uint64_t timestamp = edge.timestamp_ns;
+
+        if (_settling && timestamp - _last_accepted_ns >= _debounce_ns) {
+            settle(events);
+        }
+
+        _raw_triggered = triggered;
+        _raw_ns = timestamp;
+
+        // The first edge of a burst is reported straight away, the bounce after it is held back
+        if (timestamp - _last_accepted_ns < _debounce_ns) {
+            if (triggered && !_triggered && _missed_trip_ns == 0) {
+                _missed_trip_ns = timestamp;
+            }
+
+            _settling = true;
+            continue;
+        }
+
+        if (triggered != _triggered) {
+            accept(triggered, timestamp, events);
+        }
+    }
+}
+
+void LimitSwitch::settleIfDue(std::vector<Event> &events) {
+    if (_settling && _clock.nowNs() - _last_accepted_ns >= _debounce_ns) {
+        settle(events);
+    }
+}
+
+void LimitSwitch::accept(bool triggered, uint64_t timestamp_ns, std::vector<Event> &events) {
+    _triggered = triggered;
+    _last_accepted_ns = timestamp_ns;
+    events.push_back({triggered, timestamp_ns});
+}
+
+// Brings the reported state in line with the last edge once its window has passed
+void LimitSwitch::settle(std::vector<Event> &events) {
+    _settling = false;
+
+    // A contact that opened and closed inside the window is still a trip
+    if (_missed_trip_ns != 0 && !_triggered) {
+        accept(true, _missed_trip_ns, events);
+    }
+    _missed_trip_ns = 0;
+
+    if (_raw_triggered != _triggered) {
+        accept(_raw_triggered, std::max(_raw_ns, _last_accepted_ns), events);
+    }
+}
+
+void LimitSwitch::onTrip(TripCallback callback) {
+    {
+        std::lock_guard<std::mutex> lock(_callbacks_mutex);
+        _callbacks.push_back(std::move(callback));
+    }
+
+    if (!_watching.exchange(true)) {
+        _watcher = std::thread(&LimitSwitch::watch, this);
+    }
+}
+
+void LimitSwitch::attach(StepperController &stepper) {
+    onTrip([&stepper](const Event &) {
+        stepper.abort();
+    });
+}
+
+void LimitSwitch::watch() {
+    RealTime::promoteCurrentThread(RealTime::Role::LIMIT_SWITCH);
+
+    pollfd fds[2] = {
+        {_lines->fd(), POLLIN, 0},
+        {_wake_fd, POLLIN, 0}
+    };
+
+    std::vector<Event> events;
+
+    while (_watching) {
+        // While edges are held back by the debounce window, wake when it ends to settle them
+        uint64_t settle_ns = settleDeadlineNs();
+        timespec timeout = {};
+        if (settle_ns != 0) {
+            uint64_t now = _clock.nowNs();
+            uint64_t remaining = settle_ns > now ? settle_ns - now : 0;
+            timeout = {(time_t)(remaining / 1000000000), (long)(remaining % 1000000000)};
+        }
+
+        int ready = ppoll(fds, 2, settle_ns != 0 ? &timeout : nullptr, nullptr);
+        if (ready < 0) {
+            continue;
+        }
+
+        // Edges are only read when the fd says some are queued, a timeout just settles
+        events.clear();
+        if (ready > 0 && (fds[0].revents & POLLIN)) {
+            readEdges(events);
+        }
+        settleIfDue(events);
+
+        std::lock_guard<std::mutex> lock(_callbacks_mutex);
+        for (const Event &event : events) {
+            if (!event.triggered) {
+                continue;
+            }
+
+            for (const TripCallback &callback : _callbacks) {
+                callback(event);
+            }
+        }
+    }
+}
@@ -1,15 +1,79 @@
 #pragma once
 
-#include <gpiod.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include "GpioBackend.h"
+
+class StepperController;
 
 class LimitSwitch {
 public:
-    LimitSwitch(unsigned int pin, const std::string &chip_path);
+    struct Event {
+        bool triggered;
+        uint64_t timestamp_ns; // Edge timestamp on the backend's clock, CLOCK_MONOTONIC for libgpiod
+    };
+
+    using TripCallback = std::function<void (const Event &event)>;
+
+    // Edges within debounce of the last accepted one are treated as contact bounce. Once the
+    // window has passed the state is settled from the last edge seen, so a contact shorter than
+    // the window still trips and releases
+    LimitSwitch(unsigned int pin, const std::string &chip_path,
+                std::chrono::microseconds debounce = std::chrono::microseconds(2000),
+                GpioBackend &backend = GpioBackend::defaultBackend());
+    ~LimitSwitch();
+
     bool get();
 
+    // Readable whenever edge events are pending, can be added to an epoll set
+    int fd() const;
+    bool waitForEdge(std::chrono::nanoseconds timeout);
+    // Drains pending edges through the debounce filter and appends the accepted ones, without
+    // blocking. Call again after settleDeadlineNs() so edges hidden by the window are settled
+    size_t readEvents(std::vector<Event> &events);
+    // When the current debounce window ends if edges were dropped in it, otherwise 0
+    uint64_t settleDeadlineNs() const;
+
+    // Callbacks run on a watcher thread as soon as the switch trips. While watching,
+    // the watcher owns the event stream and readEvents() should not be used.
+    void onTrip(TripCallback callback);
+    // Aborts any move the stepper is running when the switch trips
+    void attach(StepperController &stepper);
+
 private:
-    gpiod::chip _chip;
     unsigned int _pin;
-    gpiod::line_request _request;
-};
\ No newline at end of file
+    Clock &_clock;
+    std::unique_ptr<GpioLines> _lines;
+
+    std::vector<GpioLines::Edge> _edges;
+    uint64_t _debounce_ns;
+    uint64_t _last_accepted_ns = 0;
+    bool _triggered;
+
+    // The last edge seen, accepted or not
+    bool _raw_triggered;
+    uint64_t _raw_ns = 0;
+    // Edges were dropped in the current window
+    bool _settling = false;
+    // First trip dropped in the window while released, 0 if none
+    uint64_t _missed_trip_ns = 0;
+
+    std::mutex _callbacks_mutex;
+    std::vector<TripCallback> _callbacks;
+    std::atomic<bool> _watching;
+    int _wake_fd;
+    std::thread _watcher;
+
+    void readEdges(std::vector<Event> &events);
+    void settleIfDue(std::vector<Event> &events);
+    void accept(bool triggered, uint64_t timestamp_ns, std::vector<Event> &events);
+    void settle(std::vector<Event> &events);
+    void watch();
+};
@@ -0,0 +1,102 @@
+#include "Log.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace Log {
+    static const char *const PREFIXES[] = {
+        "\x1b[90m[DEBUG]\x1b[0m ",
+        "\x1b[36m[INFO]\x1b[0m ",
+        "\x1b[33m[WARNING]\x1b[0m ",
+        "\x1b[31;1m[ERROR]\x1b[0m "
+    };
+
+    // How long the writer sleeps when it finds the ring empty
+    static constexpr std::chrono::milliseconds DRAIN_INTERVAL{2};
+
+    static std::atomic<Level> runtime_level{Level::INFO};
+    static std::atomic<uint64_t> dropped{0};
+
+    class Writer {
+        public:
+            Writer() : _thread(&Writer::run, this) {}
+
+            ~Writer() {
+                _stopping = true;
+                _thread.join();
+            }
+
+            Ring ring;
+
+        private:
+            std::atomic<bool> _stopping{false};
+            std::thread _thread;
+
+            bool drain() {
+                bool wrote = false;
+
+                while (ring.tryPop([](const Message &message) {
+                    FILE *stream = message.level >= Level::WARNING ? stderr : stdout;
+                    fputs(PREFIXES[(size_t)message.level], stream);
+                    fwrite(message.text, 1, message.length, stream);
+                    fputc('\n', stream);
+                })) {
+                    wrote = true;
+                }
+
+                uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+                if (lost > 0) {
+                    fprintf(stderr, "%s%llu log messages dropped, the ring was full\n", PREFIXES[(size_t)Level::WARNING], (unsigned long long)lost);
+                    wrote = true;
+                }
+
+                if (wrote) {
+                    fflush(stdout);
+                    fflush(stderr);
+                }
+
+                return wrote;
+            }
+
+            void run() {
+                while (!_stopping) {
+                    if (!drain()) {
+                        std::this_thread::sleep_for(DRAIN_INTERVAL);
+                    }
+                }
+
+                drain();
+            }
+    };
+
+    static Writer &writer() {
+        static Writer instance;
+        return instance;
+    }
+
+    Ring &ring() {
+        return writer().ring;
+    }
+
+    void reportDropped() {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void setLevel(Level level) {
+        runtime_level.store(level, std::memory_order_relaxed);
+    }
+
+    bool enabled(Level level) {
+        return level >= COMPILED_LEVEL && level >= runtime_level.load(std::memory_order_relaxed);
+    }
+
+    void flush() {
+        Ring &queue = ring();
+        size_t target = queue.pushed();
+
+        while (queue.popped() < target) {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }
+}
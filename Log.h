@@ -0,0 +1,122 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+#include <type_traits>
+
+#include "MpscRing.h"
+
+// Levels below this are compiled out entirely, e.g. -DLOG_COMPILED_LEVEL=2 keeps warnings and errors
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL 0
+#endif
+
+// Asynchronous logger. Callers format straight into a slot of a lock-free ring and return;
+// one background thread drains the ring to stdout (debug, info) and stderr (warning, error).
+// A full ring drops the message rather than block, and the drops are reported once it drains.
+namespace Log {
+    enum class Level : uint8_t {
+        DEBUG,
+        INFO,
+        WARNING,
+        ERROR
+    };
+
+    constexpr Level COMPILED_LEVEL = static_cast<Level>(LOG_COMPILED_LEVEL);
+
+    // Longer messages are truncated
+    constexpr size_t MESSAGE_SIZE = 240;
+    constexpr size_t RING_CAPACITY = 1024;
+
+    struct Message {
+        Level level;
+        uint16_t length;
+        char text[MESSAGE_SIZE];
+    };
+
+    using Ring = MpscRing<Message, RING_CAPACITY>;
+
+    // Messages below the runtime level are discarded before formatting, INFO by default
+    void setLevel(Level level);
+    bool enabled(Level level);
+
+    // Blocks until everything logged before the call has been written out
+    void flush();
+
+    Ring &ring();
+    void reportDropped();
+
+    template <typename T>
+    void append(Message &message, const T &value) {
+        char *out = message.text + message.length;
+        char *end = message.text + MESSAGE_SIZE;
+
+        if constexpr (std::is_same_v<T, bool>) {
+            append(message, value ? "true" : "false");
+        } else if constexpr (std::is_same_v<T, char>) {
+            append(message, std::string_view(&value, 1));
+        } else if constexpr (std::is_integral_v<T>) {
+            auto result = std::to_chars(out, end, value);
+            if (result.ec == std::errc()) {
+                message.length = result.ptr - message.text;
+            }
+        } else if constexpr (std::is_floating_point_v<T>) {
+            int written = snprintf(out, end - out, "%g", (double)value);
+            message.length += std::clamp<int>(written, 0, end - out - 1);
+        } else {
+            std::string_view text(value);
+            size_t count = std::min<size_t>(text.size(), end - out);
+            std::copy_n(text.data(), count, out);
+            message.length += count;
+        }
+    }
+
+    template <typename... Args>
+    void write(Level level, const Args &...args) {
+        if (!enabled(level)) {
+            return;
+        }
+
+        bool queued = ring().tryPush([&](Message &message) {
+            message.level = level;
+            message.length = 0;
+            (append(message, args), ...);
+        });
+
+        if (!queued) {
+            reportDropped();
+        }
+    }
+
+    template <typename... Args>
+    void debug(const Args &...args) {
+        if constexpr (Level::DEBUG >= COMPILED_LEVEL) {
+            write(Level::DEBUG, args...);
+        }
+    }
+
+    template <typename... Args>
+    void info(const Args &...args) {
+        if constexpr (Level::INFO >= COMPILED_LEVEL) {
+            write(Level::INFO, args...);
+        }
+    }
+
+    template <typename... Args>
+    void warning(const Args &...args) {
+        if constexpr (Level::WARNING >= COMPILED_LEVEL) {
+            write(Level::WARNING, args...);
+        }
+    }
+
+    template <typename... Args>
+    void error(const Args &...args) {
+        if constexpr (Level::ERROR >= COMPILED_LEVEL) {
+            write(Level::ERROR, args...);
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#include "MagnetBank.h"
+
+#include <stdexcept>
+
+MagnetBank::MagnetBank(const std::vector<unsigned int> &pins,
+                       const std::string &chip_path,
+                       GpioBackend &backend)
+    : _pins(pins),
+      _lines(backend.request(chip_path, "magnet_bank", {pins})),
+      _state(pins.size(), false)
+{
+    _changes.reserve(pins.size());
+}
+
+void MagnetBank::set(size_t index, bool value) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (index >= _pins.size()) {
+        throw std::out_of_range("MagnetBank has no magnet " + std::to_string(index));
+    }
+
+    if (_state[index] != value) {
+        _lines->setValue(_pins[index], value);
+        _state[index] = value;
+        Telemetry::record(_telemetry_source, Telemetry::Kind::MAGNET_SET, value, index);
+    }
+}
+
+size_t MagnetBank::apply(const std::vector<bool> &pattern) {
+    if (pattern.size() != _pins.size()) {
+        throw std::invalid_argument("MagnetBank::apply needs one value per magnet");
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    _changes.clear();
+    for (size_t i = 0; i < _pins.size(); i++) {
+        if (pattern[i] != _state[i]) {
+            _changes.emplace_back(_pins[i], pattern[i]);
+        }
+    }
+
+    if (_changes.empty()) {
+        return 0;
+    }
+
+    _lines->setValues(_changes);
+
+    for (size_t i = 0; i < _pins.size(); i++) {
+        if (pattern[i] != _state[i]) {
+            _state[i] = pattern[i];
+            Telemetry::record(_telemetry_source, Telemetry::Kind::MAGNET_SET, pattern[i], i);
+        }
+    }
+
+    return _changes.size();
+}
+
+void MagnetBank::clear() {
+    apply(std::vector<bool>(_pins.size(), false));
+}
+
+bool MagnetBank::get(size_t index) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _state.at(index);
+}
+
+std::vector<bool> MagnetBank::state() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _state;
+}
\ No newline at end of file
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "GpioBackend.h"
+#include "Telemetry.h"
+
+// A bank of magnets held in a single line request. Patterns are applied as the difference
+// from the current state, written in one setValues call so every changed magnet flips together.
+class MagnetBank {
+    public:
+        MagnetBank(const std::vector<unsigned int> &pins, const std::string &chip_path,
+                   GpioBackend &backend = GpioBackend::defaultBackend());
+
+        MagnetBank(const MagnetBank&) = delete;
+        MagnetBank& operator=(const MagnetBank&) = delete;
+
+        // Magnets are addressed by their index in pins
+        void set(size_t index, bool value);
+        // One value per magnet. Returns how many lines changed
+        size_t apply(const std::vector<bool> &pattern);
+        void clear();
+
+        bool get(size_t index) const;
+        std::vector<bool> state() const;
+        size_t size() const { return _pins.size(); }
+
+        // Set by Telemetry::Recorder::add, each changed magnet is recorded under this source
+        void setTelemetrySource(Telemetry::Source source) { _telemetry_source = source; }
+
+    private:
+        std::vector<unsigned int> _pins;
+        std::unique_ptr<GpioLines> _lines;
+
+        mutable std::mutex _mutex;
+        std::vector<bool> _state;
+        GpioLines::Values _changes;
+        Telemetry::Source _telemetry_source = Telemetry::NO_SOURCE;
+};
\ No newline at end of file
@@ -1,18 +1,25 @@
 #pragma once
 
-#include <gpiod.hpp>
+#include <memory>
 #include <string>
 
+#include "GpioBackend.h"
+#include "Telemetry.h"
+
 class MagnetController {
 public:
-    MagnetController(unsigned int pin, const std::string &chip_path);
+    MagnetController(unsigned int pin, const std::string &chip_path,
+                     GpioBackend &backend = GpioBackend::defaultBackend());
     void set(bool value);
 
     bool getActive() { return _active; };
 
+    // Set by Telemetry::Recorder::add, commands are recorded under this source
+    void setTelemetrySource(Telemetry::Source source) { _telemetry_source = source; }
+
 private:
-    gpiod::chip _chip;
     unsigned int _pin;
-    gpiod::line_request _request;
+    std::unique_ptr<GpioLines> _lines;
     bool _active = false;
+    Telemetry::Source _telemetry_source = Telemetry::NO_SOURCE;
 };
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include "Metrics.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+namespace Metrics {
+    static constexpr size_t OP_COUNT = (size_t)Op::COUNT;
+
+    // Only the owning thread writes a shard, so load + store is enough and no RMW is needed
+    struct Shard {
+        std::atomic<uint64_t> buckets[OP_COUNT][BUCKET_COUNT];
+        std::atomic<uint64_t> errors[OP_COUNT];
+        std::atomic<uint64_t> sum_ns[OP_COUNT];
+        std::atomic<uint64_t> max_ns[OP_COUNT];
+        bool in_use = false; // Guarded by shards_mutex
+
+        Shard() {
+            clear();
+        }
+
+        void clear() {
+            for (size_t op = 0; op < OP_COUNT; op++) {
+                for (auto &bucket : buckets[op]) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+                errors[op].store(0, std::memory_order_relaxed);
+                sum_ns[op].store(0, std::memory_order_relaxed);
+                max_ns[op].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void add(const Shard &other) {
+            for (size_t op = 0; op < OP_COUNT; op++) {
+                for (size_t i = 0; i < BUCKET_COUNT; i++) {
+                    buckets[op][i].store(buckets[op][i].load(std::memory_order_relaxed) +
+                                         other.buckets[op][i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                }
+                errors[op].store(errors[op].load(std::memory_order_relaxed) +
+                                 other.errors[op].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                sum_ns[op].store(sum_ns[op].load(std::memory_order_relaxed) +
+                                 other.sum_ns[op].load(std::memory_order_relaxed), std::memory_order_relaxed);
+                max_ns[op].store(std::max(max_ns[op].load(std::memory_order_relaxed),
+                                          other.max_ns[op].load(std::memory_order_relaxed)), std::memory_order_relaxed);
+            }
+        }
+    };
+
+    // A thread's shard goes back to be reused when it exits, with its counts folded into
+    // retired, so short-lived threads neither lose what they recorded nor grow memory
+    static std::mutex shards_mutex;
+    static std::vector<std::unique_ptr<Shard>> shards;
+    static Shard retired;
+
+    struct ShardOwner {
+        Shard *shard = nullptr;
+
+        ~ShardOwner() {
+            if (!shard) {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(shards_mutex);
+            retired.add(*shard);
+            shard->clear();
+            shard->in_use = false;
+        }
+    };
+
+    static Shard &localShard() {
+        thread_local ShardOwner owner;
+
+        if (!owner.shard) {
+            std::lock_guard<std::mutex> lock(shards_mutex);
+
+            for (const auto &shard : shards) {
+                if (!shard->in_use) {
+                    owner.shard = shard.get();
+                    break;
+                }
+            }
+
+            if (!owner.shard) {
+                shards.push_back(std::make_unique<Shard>());
+                owner.shard = shards.back().get();
+            }
+
+            owner.shard->in_use = true;
+        }
+
+        return *owner.shard;
+    }
+
+    static void bump(std::atomic<uint64_t> &counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    const char *name(Op op) {
+        switch (op) {
+            case Op::MODBUS_READ_32: return "modbus_read_32";
+            case Op::MODBUS_WRITE_32: return "modbus_write_32";
+            case Op::MODBUS_READ_FLAG: return "modbus_read_flag";
+            case Op::STEP_SET_VALUE: return "step_set_value";
+            case Op::STEP_PERIOD: return "step_period";
+            case Op::PWM_SET_VALUES: return "pwm_set_values";
+            case Op::WAKEUP_LATENCY: return "wakeup_latency";
+            default: return "unknown";
+        }
+    }
+
+    size_t bucketIndex(uint64_t value) {
+        const uint64_t sub_count = 1 << SUB_BUCKET_BITS;
+
+        if (value < sub_count) {
+            return value;
+        }
+
+        int exponent = 63 - __builtin_clzll(value);
+        if (exponent > MAX_EXPONENT) {
+            return BUCKET_COUNT - 1;
+        }
+
+        int shift = exponent - SUB_BUCKET_BITS;
+        return sub_count * (shift + 1) + ((value >> shift) & (sub_count - 1));
+    }
+
+    uint64_t bucketValue(size_t index) {
+        const uint64_t sub_count = 1 << SUB_BUCKET_BITS;
+
+        if (index < sub_count) {
+            return index;
+        }
+
+        int shift = index / sub_count - 1;
+        return (sub_count + index % sub_count) << shift;
+    }
+
+    uint64_t Histogram::percentile(double percent) const {
+        if (count == 0) {
+            return 0;
+        }
+
+        uint64_t target = (uint64_t)(percent / 100.0 * count + 0.5);
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < buckets.size(); i++) {
+            seen += buckets[i];
+            if (seen >= target && buckets[i] > 0) {
+                return std::min(bucketValue(i), max_ns);
+            }
+        }
+
+        return max_ns;
+    }
+
+    void record(Op op, uint64_t latency_ns) {
+        Shard &shard = localShard();
+        size_t index = (size_t)op;
+
+        bump(shard.buckets[index][bucketIndex(latency_ns)], 1);
+        bump(shard.sum_ns[index], latency_ns);
+
+        if (latency_ns > shard.max_ns[index].load(std::memory_order_relaxed)) {
+            shard.max_ns[index].store(latency_ns, std::memory_order_relaxed);
+        }
+    }
+
+    void recordError(Op op) {
+        bump(localShard().errors[(size_t)op], 1);
+    }
+
+    void recordSince(Op op, uint64_t start_ns, bool ok) {
+        if (ok) {
+            record(op, Utils::monotonicNs() - start_ns);
+        } else {
+            recordError(op);
+        }
+    }
+
+    Histogram snapshot(Op op) {
+        size_t index = (size_t)op;
+
+        Histogram histogram;
+        histogram.buckets.assign(BUCKET_COUNT, 0);
+
+        auto add = [&](const Shard &shard) {
+            for (size_t i = 0; i < BUCKET_COUNT; i++) {
+                uint64_t count = shard.buckets[index][i].load(std::memory_order_relaxed);
+                histogram.buckets[i] += count;
+                histogram.count += count;
+            }
+
+            histogram.errors += shard.errors[index].load(std::memory_order_relaxed);
+            histogram.sum_ns += shard.sum_ns[index].load(std::memory_order_relaxed);
+            histogram.max_ns = std::max(histogram.max_ns, shard.max_ns[index].load(std::memory_order_relaxed));
+        };
+
+        // Free shards are zeroed, their counts are in retired
+        std::lock_guard<std::mutex> lock(shards_mutex);
+        add(retired);
+        for (const auto &shard : shards) {
+            add(*shard);
+        }
+
+        return histogram;
+    }
+
+    void dump(std::ostream &out) {
+        out << "{";
+
+        for (size_t op = 0; op < OP_COUNT; op++) {
+            Histogram histogram = snapshot((Op)op);
+
+            out << (op ? ", " : "") << "\"" << name((Op)op) << "\": {"
+                << "\"count\": " << histogram.count
+                << ", \"errors\": " << histogram.errors
+                << ", \"mean_ns\": " << (uint64_t)histogram.mean()
+                << ", \"p50_ns\": " << histogram.percentile(50)
+                << ", \"p99_ns\": " << histogram.percentile(99)
+                << ", \"p999_ns\": " << histogram.percentile(99.9)
+                << ", \"max_ns\": " << histogram.max_ns
+                << "}";
+        }
+
+        out << "}" << std::endl;
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+// Latency histograms for the Modbus and GPIO hot paths. Every thread records into its
+// own buckets with plain relaxed stores, readers sum the threads' buckets on demand,
+// so recording costs a clock read and a couple of cache-local writes.
+namespace Metrics {
+    enum class Op {
+        MODBUS_READ_32,
+        MODBUS_WRITE_32,
+        MODBUS_READ_FLAG,
+        STEP_SET_VALUE,
+        STEP_PERIOD,
+        PWM_SET_VALUES,
+        WAKEUP_LATENCY, // How late absolute sleeps (Utils::sleepUntilNs) return
+        COUNT
+    };
+
+    // Log-linear buckets: 16 per power of two, so any value is within ~6% of its bucket
+    constexpr int SUB_BUCKET_BITS = 4;
+    constexpr int MAX_EXPONENT = 40;
+    constexpr size_t BUCKET_COUNT = (1 << SUB_BUCKET_BITS) * (MAX_EXPONENT - SUB_BUCKET_BITS + 2);
+
+    struct Histogram {
+        uint64_t count = 0;
+        uint64_t errors = 0;
+        uint64_t sum_ns = 0;
+        uint64_t max_ns = 0;
+        std::vector<uint64_t> buckets;
+
+        uint64_t percentile(double percent) const;
+        double mean() const { return count ? (double)sum_ns / count : 0; }
+    };
+
+    const char *name(Op op);
+
+    void record(Op op, uint64_t latency_ns);
+    void recordError(Op op);
+    // Records the time since start_ns (Utils::monotonicNs) on success, an error otherwise
+    void recordSince(Op op, uint64_t start_ns, bool ok = true);
+
+    Histogram snapshot(Op op);
+    // Every operation as one JSON object
+    void dump(std::ostream &out);
+
+    size_t bucketIndex(uint64_t value);
+    uint64_t bucketValue(size_t index);
+}
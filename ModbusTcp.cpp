@@ -0,0 +1,89 @@
+#include "ModbusTcp.h"
+
+namespace ModbusTcp {
+    static void put16(std::vector<uint8_t> &out, uint16_t value) {
+        out.push_back((uint8_t)(value >> 8));
+        out.push_back((uint8_t)(value & 0xFF));
+    }
+
+    static uint16_t get16(const uint8_t *data) {
+        return (uint16_t)((data[0] << 8) | data[1]);
+    }
+
+    static void putHeader(std::vector<uint8_t> &out, uint16_t transaction_id, uint8_t unit_id, uint16_t pdu_length) {
+        put16(out, transaction_id);
+        put16(out, 0);
+        put16(out, pdu_length + 1);
+        out.push_back(unit_id);
+    }
+
+    void encodeReadRegisters(std::vector<uint8_t> &out, uint16_t transaction_id, uint8_t unit_id,
+                             uint16_t address, uint16_t count) {
+        putHeader(out, transaction_id, unit_id, 5);
+        out.push_back(READ_HOLDING_REGISTERS);
+        put16(out, address);
+        put16(out, count);
+    }
+
+    void encodeWriteRegisters(std::vector<uint8_t> &out, uint16_t transaction_id, uint8_t unit_id,
+                              uint16_t address, const uint16_t *values, uint16_t count) {
+        putHeader(out, transaction_id, unit_id, 6 + count * 2);
+        out.push_back(WRITE_MULTIPLE_REGISTERS);
+        put16(out, address);
+        put16(out, count);
+        out.push_back((uint8_t)(count * 2));
+
+        for (uint16_t i = 0; i < count; i++) {
+            put16(out, values[i]);
+        }
+    }
+
+    long frameLength(const uint8_t *data, size_t size) {
+        if (size < MBAP_HEADER_LENGTH) {
+            return 0;
+        }
+
+        uint16_t length = get16(data + 4);
+        if (get16(data + 2) != 0 || length < 2 || length + 6u > MAX_ADU_LENGTH) {
+            return -1;
+        }
+
+        return size >= length + 6u ? (long)(length + 6) : 0;
+    }
+
+    bool decode(const uint8_t *frame, size_t length, Response &response) {
+        if (length < MBAP_HEADER_LENGTH + 1) {
+            return false;
+        }
+
+        response.transaction_id = get16(frame);
+        response.unit_id = frame[6];
+        response.function = frame[7] & 0x7F;
+        response.exception_code = 0;
+        response.payload = frame + MBAP_HEADER_LENGTH + 1;
+        response.payload_length = length - MBAP_HEADER_LENGTH - 1;
+
+        if (frame[7] & 0x80) {
+            response.exception_code = response.payload_length > 0 ? response.payload[0] : 0xFF;
+        }
+
+        return true;
+    }
+
+    bool decodeRegisters(const Response &response, uint16_t *dest, int count) {
+        if (response.exception_code != 0 || response.function != READ_HOLDING_REGISTERS) {
+            return false;
+        }
+
+        if (response.payload_length < 1 || response.payload[0] != count * 2 ||
+            response.payload_length < 1 + (size_t)count * 2) {
+            return false;
+        }
+
+        for (int i = 0; i < count; i++) {
+            dest[i] = get16(response.payload + 1 + i * 2);
+        }
+
+        return true;
+    }
+}
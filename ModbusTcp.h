@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Minimal Modbus TCP framing for transports that drive the socket themselves
+// instead of going through libmodbus' blocking request/response calls.
+namespace ModbusTcp {
+    constexpr size_t MBAP_HEADER_LENGTH = 7;
+    constexpr size_t MAX_ADU_LENGTH = 260;
+
+    constexpr uint8_t READ_HOLDING_REGISTERS = 0x03;
+    constexpr uint8_t WRITE_MULTIPLE_REGISTERS = 0x10;
+
+    struct Response {
+        uint16_t transaction_id;
+        uint8_t unit_id;
+        uint8_t function;
+        uint8_t exception_code;
+        const uint8_t *payload;
+        size_t payload_length;
+    };
+
+    void encodeReadRegisters(std::vector<uint8_t> &out, uint16_t transaction_id, uint8_t unit_id,
+                             uint16_t address, uint16_t count);
+    void encodeWriteRegisters(std::vector<uint8_t> &out, uint16_t transaction_id, uint8_t unit_id,
+                              uint16_t address, const uint16_t *values, uint16_t count);
+
+    // Length of the complete frame at the start of data, 0 if more bytes are needed, -1 if malformed
+    long frameLength(const uint8_t *data, size_t size);
+    bool decode(const uint8_t *frame, size_t length, Response &response);
+    bool decodeRegisters(const Response &response, uint16_t *dest, int count);
+}
@@ -0,0 +1,128 @@
+#include "MotionProfile.h"
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+
+// Guards against ramps that would take millions of steps at tiny accelerations
+static const size_t MAX_RAMP_STEPS = 100000;
+static const size_t CACHE_SIZE = 32;
+
+struct CachedRamp {
+    uint32_t cruise_period_ns;
+    uint32_t acceleration;
+    MotionProfile::Shape shape;
+    std::shared_ptr<const std::vector<uint32_t>> ramp;
+};
+
+static std::mutex cache_mutex;
+static std::list<CachedRamp> cache;
+
+static uint64_t isqrt(uint64_t value) {
+    if (value < 2) {
+        return value;
+    }
+
+    uint64_t x = value;
+    uint64_t y = (x + 1) / 2;
+    while (y < x) {
+        x = y;
+        y = (x + value / x) / 2;
+    }
+
+    return x;
+}
+
+bool MotionProfile::cruisePeriodNs(int delay_us, uint32_t &period_ns) {
+    if (delay_us < 0 || delay_us > MAX_DELAY_US) {
+        return false;
+    }
+
+    period_ns = (uint32_t)((uint64_t)delay_us * 2000);
+    return true;
+}
+
+// First step period for a standstill start, c0 = 0.676 * sqrt(2 / a) seconds
+static uint64_t firstPeriodNs(uint32_t acceleration) {
+    uint64_t root_q20 = isqrt((2ull << 40) / acceleration);
+    return (676000000ull * root_q20) >> 20;
+}
+
+MotionProfile::MotionProfile(uint32_t cruise_period_ns, uint32_t acceleration, Shape shape)
+    : _cruise_period_ns(cruise_period_ns),
+      _ramp(acceleration > 0 ? ramp(cruise_period_ns, acceleration, shape) : nullptr)
+{}
+
+uint32_t MotionProfile::periodNs(int step, int steps) const {
+    size_t from_edge = std::min(step, steps - 1 - step);
+
+    if (_ramp && from_edge < _ramp->size()) {
+        return (*_ramp)[from_edge];
+    }
+
+    return _cruise_period_ns;
+}
+
+std::shared_ptr<const std::vector<uint32_t>> MotionProfile::ramp(uint32_t cruise_period_ns, uint32_t acceleration, Shape shape) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (it->cruise_period_ns == cruise_period_ns && it->acceleration == acceleration && it->shape == shape) {
+            cache.splice(cache.begin(), cache, it);
+            return it->ramp;
+        }
+    }
+
+    std::vector<uint32_t> table = shape == Shape::S_CURVE ? buildSCurve(cruise_period_ns, acceleration)
+                                                         : buildTrapezoidal(cruise_period_ns, acceleration);
+
+    cache.push_front({cruise_period_ns, acceleration, shape, std::make_shared<const std::vector<uint32_t>>(std::move(table))});
+    if (cache.size() > CACHE_SIZE) {
+        cache.pop_back();
+    }
+
+    return cache.front().ramp;
+}
+
+std::vector<uint32_t> MotionProfile::buildTrapezoidal(uint32_t cruise_period_ns, uint32_t acceleration) {
+    std::vector<uint32_t> table;
+
+    // Austin's recurrence c_n = c_(n-1) - 2 c_(n-1) / (4n + 1), kept with 8 fractional bits
+    uint64_t period_q8 = firstPeriodNs(acceleration) << 8;
+
+    for (uint64_t n = 1; (period_q8 >> 8) > cruise_period_ns && table.size() < MAX_RAMP_STEPS; n++) {
+        table.push_back((uint32_t)std::min<uint64_t>(period_q8 >> 8, UINT32_MAX));
+        period_q8 -= (2 * period_q8) / (4 * n + 1);
+    }
+
+    return table;
+}
+
+std::vector<uint32_t> MotionProfile::buildSCurve(uint32_t cruise_period_ns, uint32_t acceleration) {
+    std::vector<uint32_t> table;
+
+    // Velocity follows smoothstep 3u^2 - 2u^3 over the ramp time T. Its peak slope is
+    // 1.5 vmax / T, so T = 1.5 vmax / a keeps the peak acceleration at a.
+    uint64_t max_rate = std::max<uint64_t>(1000000000ull / cruise_period_ns, 1);
+    uint64_t ramp_ns = 1500000000ull * max_rate / acceleration;
+    uint64_t ramp_q16 = std::max<uint64_t>(ramp_ns >> 16, 1);
+    uint64_t min_rate = std::max<uint64_t>(1000000000ull / firstPeriodNs(acceleration), 1);
+
+    uint64_t time_ns = 0;
+    while (table.size() < MAX_RAMP_STEPS) {
+        uint64_t u = std::min<uint64_t>(time_ns / ramp_q16, 1 << 16);
+        uint64_t u2 = (u * u) >> 16;
+        uint64_t u3 = (u2 * u) >> 16;
+        uint64_t rate = std::max((max_rate * (3 * u2 - 2 * u3)) >> 16, min_rate);
+
+        uint64_t period = 1000000000ull / rate;
+        if (period <= cruise_period_ns) {
+            break;
+        }
+
+        table.push_back((uint32_t)std::min<uint64_t>(period, UINT32_MAX));
+        time_ns += period;
+    }
+
+    return table;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Per-step periods for ramped stepper moves, computed in integer nanoseconds.
+// Only the acceleration ramp depends on the speed and acceleration, the cruise is
+// constant and deceleration mirrors the ramp, so ramps are cached and shared by
+// every move with the same cruise period, acceleration and shape whatever its length.
+class MotionProfile {
+    public:
+        enum class Shape {
+            TRAPEZOIDAL,
+            S_CURVE
+        };
+
+        // Longest step delay (half a period) whose period still fits cruise_period_ns
+        static constexpr int MAX_DELAY_US = UINT32_MAX / 2000;
+
+        // The cruise period for a step delay, false if delay_us is negative or above MAX_DELAY_US
+        static bool cruisePeriodNs(int delay_us, uint32_t &period_ns);
+
+        // acceleration is in steps/s^2, 0 starts and stops at full speed
+        MotionProfile(uint32_t cruise_period_ns, uint32_t acceleration, Shape shape);
+
+        // Period of step index `step` in a move of `steps` steps
+        uint32_t periodNs(int step, int steps) const;
+
+        size_t rampLength() const { return _ramp ? _ramp->size() : 0; }
+        // Period of step `index` of the acceleration ramp, index < rampLength()
+        uint32_t rampPeriodNs(size_t index) const { return (*_ramp)[index]; }
+
+        static std::shared_ptr<const std::vector<uint32_t>> ramp(uint32_t cruise_period_ns, uint32_t acceleration, Shape shape);
+
+    private:
+        uint32_t _cruise_period_ns;
+        std::shared_ptr<const std::vector<uint32_t>> _ramp;
+
+        static std::vector<uint32_t> buildTrapezoidal(uint32_t cruise_period_ns, uint32_t acceleration);
+        static std::vector<uint32_t> buildSCurve(uint32_t cruise_period_ns, uint32_t acceleration);
+};
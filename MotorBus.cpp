@@ -0,0 +1,656 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "MotorBus.h"
+#include "ModbusTcp.h"
+#include "Log.h"
+#include "Utils.h"
+
+using namespace std::chrono;
+
+MotorBus::MotorBus(milliseconds request_timeout, size_t pipeline_depth)
+    : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)),
+      request_timeout_(request_timeout),
+      pipeline_depth_(std::max<size_t>(pipeline_depth, 1))
+{}
+
+MotorBus::~MotorBus() {
+    while (!connections_.empty()) {
+        close(*connections_.back());
+    }
+
+    runCallbacks();
+
+    if (epoll_fd_ != -1) {
+        ::close(epoll_fd_);
+    }
+}
+
+bool MotorBus::add(MotorController &motor) {
+    if (Connection *existing = find(motor)) {
+        if (!existing->broken) {
+            return true;
+        }
+
+        // Re-attach over the socket the motor's supervisor reconnected with
+        remove(motor);
+    }
+
+    if (Connection *gateway = findGateway(motor)) {
+        gateway->motors.push_back(&motor);
+        motors_.push_back(&motor);
+        return true;
+    }
+
+    int fd = -1;
+    {
+        std::lock_guard<std::mutex> lock(motor.ctx_mutex_);
+        if (motor.ctx_) {
+            fd = modbus_get_socket(motor.ctx_);
+        }
+    }
+
+    if (fd == -1) {
+        Log::error("Cannot add motor ", motor.ip_address_, " to bus: Not connected");
+        return false;
+    }
+
+    auto connection = std::make_unique<Connection>();
+    connection->motors.push_back(&motor);
+    connection->fd = fd;
+    connection->saved_flags = fcntl(connection->fd, F_GETFL);
+
+    if (epoll_fd_ == -1 || connection->saved_flags == -1 ||
+        fcntl(connection->fd, F_SETFL, connection->saved_flags | O_NONBLOCK) == -1) {
+        Log::error("Cannot add motor ", motor.ip_address_, " to bus: ", strerror(errno));
+        return false;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.ptr = connection.get();
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, connection->fd, &event) == -1) {
+        Log::error("Cannot add motor ", motor.ip_address_, " to bus: ", strerror(errno));
+        fcntl(connection->fd, F_SETFL, connection->saved_flags);
+        return false;
+    }
+
+    connections_.push_back(std::move(connection));
+    motors_.push_back(&motor);
+    return true;
+}
+
+void MotorBus::remove(MotorController &motor) {
+    Connection *connection = find(motor);
+    if (!connection) {
+        return;
+    }
+
+    motors_.erase(std::find(motors_.begin(), motors_.end(), &motor));
+
+    if (connection->motors.front() != &motor) {
+        auto &motors = connection->motors;
+        motors.erase(std::find(motors.begin(), motors.end(), &motor));
+        return;
+    }
+
+    // The socket belongs to this motor, the other slaves move to a socket of their own
+    std::vector<MotorController *> others(connection->motors.begin() + 1, connection->motors.end());
+    close(*connection);
+
+    for (MotorController *other : others) {
+        add(*other);
+    }
+}
+
+void MotorBus::close(Connection &connection) {
+    // A broken connection's socket went to the supervisor, which may have closed it and had
+    // the descriptor reused, so only a live one gets its flags back
+    if (!connection.broken) {
+        connection.broken = true;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection.fd, nullptr);
+        fcntl(connection.fd, F_SETFL, connection.saved_flags);
+    }
+
+    failPending(connection);
+
+    for (MotorController *motor : connection.motors) {
+        auto it = std::find(motors_.begin(), motors_.end(), motor);
+        if (it != motors_.end()) {
+            motors_.erase(it);
+        }
+    }
+
+    connections_.erase(std::find_if(connections_.begin(), connections_.end(), [&](const std::unique_ptr<Connection> &c) {
+        return c.get() == &connection;
+    }));
+}
+
+MotorBus::Connection *MotorBus::find(const MotorController &motor) {
+    for (auto &connection : connections_) {
+        for (MotorController *attached : connection->motors) {
+            if (attached == &motor) {
+                return connection.get();
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+MotorBus::Connection *MotorBus::findGateway(const MotorController &motor) {
+    // Sharing a socket only pays off when transactions can overlap on it
+    if (pipeline_depth_ == 1) {
+        return nullptr;
+    }
+
+    for (auto &connection : connections_) {
+        const MotorController *owner = connection->motors.front();
+
+        if (!connection->broken && owner->ip_address_ == motor.ip_address_ && owner->port_ == motor.port_) {
+            return connection.get();
+        }
+    }
+
+    return nullptr;
+}
+
+bool MotorBus::submitRead(MotorController &motor, int address, int count, ReadCallback callback) {
+    Connection *connection = find(motor);
+    if (!connection || count < 1 || count > MODBUS_MAX_READ_REGISTERS) {
+        return false;
+    }
+
+    Request request;
+    request.count = count;
+    request.on_read = std::move(callback);
+    ModbusTcp::encodeReadRegisters(request.frame, 0, motor.slave_id_, address, count);
+
+    return enqueue(*connection, std::move(request));
+}
+
+bool MotorBus::submitWrite(MotorController &motor, int address, const uint16_t *values, int count, WriteCallback callback) {
+    Connection *connection = find(motor);
+    if (!connection || count < 1 || count > MODBUS_MAX_WRITE_REGISTERS) {
+        return false;
+    }
+
+    Request request;
+    request.count = 0;
+    request.on_write = std::move(callback);
+    ModbusTcp::encodeWriteRegisters(request.frame, 0, motor.slave_id_, address, values, count);
+
+    return enqueue(*connection, std::move(request));
+}
+
+bool MotorBus::submitSnapshot(MotorController &motor, SnapshotCallback callback) {
+    struct Pending {
+        MotorController::MotorState state;
+        MotorController::StatusGenerations generations;
+        size_t remaining;
+        bool ok = true;
+    };
+
+    // Held by the callbacks so every span decodes with the profile it was read with
+    std::shared_ptr<const MotorProfile> profile = motor.currentProfile();
+
+    if (profile->snapshot_spans.empty()) {
+        return false;
+    }
+
+    auto pending = std::make_shared<Pending>();
+    pending->remaining = profile->snapshot_spans.size();
+    pending->generations = motor.statusGenerations();
+
+    size_t total = profile->snapshot_spans.size();
+
+    for (size_t i = 0; i < total; i++) {
+        const MotorProfile::RegisterSpan &span = profile->snapshot_spans[i];
+        bool submitted = submitRead(motor, span.start, span.count, [&motor, profile, span, pending, callback](bool ok, const uint16_t *data, int) {
+            if (ok) {
+                motor.decodeSnapshotSpan(*profile, span, data, pending->state);
+            }
+
+            pending->ok = pending->ok && ok;
+            if (--pending->remaining == 0) {
+                if (pending->ok) {
+                    motor.fillStatusCache(pending->state, pending->generations);
+                }
+                callback(pending->ok, pending->state);
+            }
+        });
+
+        if (!submitted) {
+            if (i == 0) {
+                return false;
+            }
+
+            // Callbacks are deferred, so the spans already queued are all still to come and the
+            // last of them reports the failure
+            pending->ok = false;
+            pending->remaining -= total - i;
+            return true;
+        }
+    }
+
+    return true;
+}
+
+bool MotorBus::snapshotAll(std::vector<MotorController::MotorState> &states) {
+    states.assign(motors_.size(), MotorController::MotorState());
+    bool all_ok = true;
+
+    for (size_t i = 0; i < motors_.size(); i++) {
+        bool submitted = submitSnapshot(*motors_[i], [&states, &all_ok, i](bool ok, const MotorController::MotorState &state) {
+            states[i] = state;
+            all_ok = all_ok && ok;
+        });
+
+        all_ok = all_ok && submitted;
+    }
+
+    run();
+    return all_ok;
+}
+
+bool MotorBus::moveAll(const std::vector<GroupTarget> &targets, GroupMoveReport &report) {
+    report = GroupMoveReport();
+    if (targets.empty()) {
+        report.ok = true;
+        return true;
+    }
+
+    report.sent_ns.assign(targets.size(), 0);
+    report.acked_ns.assign(targets.size(), 0);
+
+    std::vector<Connection *> connections(targets.size(), nullptr);
+    bool all_ok = true;
+
+    holding_ = true;
+    for (size_t i = 0; i < targets.size(); i++) {
+        MotorController &motor = *targets[i].motor;
+        int32_t position = targets[i].position;
+        connections[i] = find(motor);
+
+        if (!connections[i]) {
+            all_ok = false;
+            continue;
+        }
+
+        // Same word order as MotorController::write32BitRegister
+        uint16_t data[2];
+        data[0] = (uint16_t)(position);
+        data[1] = (uint16_t)(position >> 16);
+
+        Request request;
+        request.count = 0;
+        request.sent_ns = &report.sent_ns[i];
+        request.on_write = [&report, &all_ok, i](bool ok) {
+            report.acked_ns[i] = Utils::monotonicNs();
+            all_ok = all_ok && ok;
+        };
+        ModbusTcp::encodeWriteRegisters(request.frame, 0, motor.slave_id_, motor.currentProfile()->position, data, 2);
+
+        if (!enqueue(*connections[i], std::move(request))) {
+            all_ok = false;
+            continue;
+        }
+
+        motor.last_target_ = position;
+        motor.has_target_ = true;
+        motor.dropCache(MotorController::Cached::POSITION);
+        motor.dropCache(MotorController::Cached::MOVING);
+    }
+    holding_ = false;
+
+    // The trigger: every staged frame goes out back to back
+    for (auto &connection : connections_) {
+        if (connection->tx.empty()) {
+            continue;
+        }
+
+        flush(*connection);
+        uint64_t sent = Utils::monotonicNs();
+
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (connections[i] == connection.get() && report.sent_ns[i] != 0) {
+                report.sent_ns[i] = sent;
+            }
+        }
+    }
+
+    // Targets queued behind a shallow pipeline are stamped as they are dispatched
+    run();
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (report.sent_ns[i] == 0 || report.acked_ns[i] == 0) {
+            report.ok = false;
+            return false;
+        }
+    }
+
+    uint64_t first_sent = *std::min_element(report.sent_ns.begin(), report.sent_ns.end());
+    uint64_t min_start = UINT64_MAX;
+    uint64_t max_start = 0;
+
+    for (size_t i = 0; i < targets.size(); i++) {
+        report.sent_ns[i] -= first_sent;
+        report.acked_ns[i] -= first_sent;
+
+        uint64_t start = (report.sent_ns[i] + report.acked_ns[i]) / 2;
+        min_start = std::min(min_start, start);
+        max_start = std::max(max_start, start);
+    }
+
+    report.send_skew_ns = *std::max_element(report.sent_ns.begin(), report.sent_ns.end());
+    report.ack_skew_ns = *std::max_element(report.acked_ns.begin(), report.acked_ns.end()) -
+                         *std::min_element(report.acked_ns.begin(), report.acked_ns.end());
+    report.start_skew_ns = max_start - min_start;
+    report.ok = all_ok;
+
+    Log::info("Group move of ", targets.size(), " motors: start skew ~", report.start_skew_ns / 1000, "us (sent within ",
+              report.send_skew_ns / 1000, "us, acknowledged within ", report.ack_skew_ns / 1000, "us)");
+
+    return all_ok;
+}
+
+bool MotorBus::enqueue(Connection &connection, Request request) {
+    if (connection.broken) {
+        return false;
+    }
+
+    connection.queued.push_back(std::move(request));
+    pending_++;
+
+    dispatch(connection);
+    return true;
+}
+
+void MotorBus::dispatch(Connection &connection) {
+    while (!connection.broken && connection.in_flight.size() < pipeline_depth_ && !connection.queued.empty()) {
+        Request request = std::move(connection.queued.front());
+        connection.queued.pop_front();
+
+        // IDs are handed out on the wire so one still waiting for a late reply is never reused
+        do {
+            request.transaction_id = connection.next_transaction_id++;
+        } while (connection.in_flight.count(request.transaction_id));
+
+        request.frame[0] = (uint8_t)(request.transaction_id >> 8);
+        request.frame[1] = (uint8_t)(request.transaction_id & 0xFF);
+        request.deadline = steady_clock::now() + request_timeout_;
+        if (request.sent_ns) {
+            *request.sent_ns = Utils::monotonicNs();
+        }
+        connection.tx.insert(connection.tx.end(), request.frame.begin(), request.frame.end());
+        connection.in_flight.emplace(request.transaction_id, std::move(request));
+    }
+
+    if (!holding_) {
+        flush(connection);
+    }
+}
+
+void MotorBus::flush(Connection &connection) {
+    while (!connection.broken && connection.tx_offset < connection.tx.size()) {
+        ssize_t sent = send(connection.fd, connection.tx.data() + connection.tx_offset,
+                            connection.tx.size() - connection.tx_offset, MSG_NOSIGNAL);
+
+        if (sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno == EINTR) {
+                continue;
+            }
+
+            fail(connection, strerror(errno));
+            return;
+        }
+
+        connection.tx_offset += sent;
+    }
+
+    if (connection.tx_offset == connection.tx.size()) {
+        connection.tx.clear();
+        connection.tx_offset = 0;
+    }
+
+    updateInterest(connection);
+}
+
+void MotorBus::receive(Connection &connection) {
+    uint8_t buffer[512];
+
+    while (true) {
+        ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+
+        if (received == 0) {
+            fail(connection, "Connection closed by drive");
+            return;
+        } else if (received == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if (errno == EINTR) {
+                continue;
+            }
+
+            fail(connection, strerror(errno));
+            return;
+        }
+
+        connection.rx.insert(connection.rx.end(), buffer, buffer + received);
+    }
+
+    size_t consumed = 0;
+    while (true) {
+        long length = ModbusTcp::frameLength(connection.rx.data() + consumed, connection.rx.size() - consumed);
+
+        if (length == 0) {
+            break;
+        } else if (length < 0) {
+            fail(connection, "Malformed Modbus frame");
+            return;
+        }
+
+        ModbusTcp::Response response;
+        ModbusTcp::decode(connection.rx.data() + consumed, length, response);
+        consumed += length;
+
+        // Replies to requests that already timed out are dropped here
+        auto it = connection.in_flight.find(response.transaction_id);
+        if (it == connection.in_flight.end() || it->second.frame[6] != response.unit_id) {
+            continue;
+        }
+
+        Request request = std::move(it->second);
+        connection.in_flight.erase(it);
+
+        if (request.count > 0) {
+            uint16_t data[MODBUS_MAX_READ_REGISTERS];
+            bool ok = ModbusTcp::decodeRegisters(response, data, request.count);
+            complete(request, ok, data);
+        } else {
+            bool ok = response.exception_code == 0 && response.function == ModbusTcp::WRITE_MULTIPLE_REGISTERS;
+            complete(request, ok, nullptr);
+        }
+
+        if (connection.broken) {
+            return;
+        }
+    }
+
+    connection.rx.erase(connection.rx.begin(), connection.rx.begin() + consumed);
+    dispatch(connection);
+}
+
+void MotorBus::complete(Request &request, bool ok, const uint16_t *data) {
+    pending_--;
+    defer(request, ok, data);
+}
+
+// Queues the callback for runCallbacks, the connection loops must not run user code
+void MotorBus::defer(Request &request, bool ok, const uint16_t *data) {
+    completed_.emplace_back();
+    Completion &completion = completed_.back();
+    completion.request = std::move(request);
+    completion.ok = ok;
+
+    if (ok && data && completion.request.count > 0) {
+        std::copy(data, data + completion.request.count, completion.data);
+    }
+}
+
+void MotorBus::runCallbacks() {
+    // Taken out first: a callback that submits, adds or removes can complete more
+    while (!completed_.empty()) {
+        std::vector<Completion> batch;
+        batch.swap(completed_);
+
+        for (Completion &completion : batch) {
+            Request &request = completion.request;
+
+            if (request.on_read) {
+                request.on_read(completion.ok, completion.data, completion.ok ? request.count : 0);
+            } else if (request.on_write) {
+                request.on_write(completion.ok);
+            }
+        }
+    }
+}
+
+void MotorBus::fail(Connection &connection, const char *reason) {
+    if (!connection.broken) {
+        const MotorController *owner = connection.motors.front();
+        Log::error("Motor bus connection to ", owner->ip_address_, " failed: ", reason);
+
+        connection.broken = true;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection.fd, nullptr);
+
+        // Hand the dead socket to the motor's supervisor, add() the motor again once it is back
+        owner->reportLinkFailure(connection.fd);
+    }
+
+    failPending(connection);
+}
+
+void MotorBus::failPending(Connection &connection) {
+    std::vector<Request> failed;
+    for (auto &entry : connection.in_flight) {
+        failed.push_back(std::move(entry.second));
+    }
+    for (auto &request : connection.queued) {
+        failed.push_back(std::move(request));
+    }
+
+    connection.in_flight.clear();
+    connection.queued.clear();
+    connection.tx.clear();
+    connection.tx_offset = 0;
+    connection.rx.clear();
+
+    for (auto &request : failed) {
+        complete(request, false, nullptr);
+    }
+}
+
+void MotorBus::expire(steady_clock::time_point now) {
+    for (auto &connection : connections_) {
+        std::vector<Request> expired;
+
+        for (auto it = connection->in_flight.begin(); it != connection->in_flight.end();) {
+            if (it->second.deadline <= now) {
+                expired.push_back(std::move(it->second));
+                it = connection->in_flight.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        for (auto &request : expired) {
+            complete(request, false, nullptr);
+        }
+
+        if (!expired.empty()) {
+            dispatch(*connection);
+        }
+    }
+}
+
+void MotorBus::updateInterest(Connection &connection) {
+    bool want_write = !connection.tx.empty();
+    if (connection.broken || want_write == connection.watching_write) {
+        return;
+    }
+
+    epoll_event event = {};
+    event.events = want_write ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    event.data.ptr = &connection;
+
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event) == 0) {
+        connection.watching_write = want_write;
+    }
+}
+
+void MotorBus::poll(int timeout_ms) {
+    auto now = steady_clock::now();
+
+    // Completions still waiting for their callbacks are delivered without sleeping
+    if (!completed_.empty()) {
+        timeout_ms = 0;
+    }
+
+    // Never sleep past the earliest request deadline
+    for (auto &connection : connections_) {
+        for (auto &entry : connection->in_flight) {
+            int until_deadline = (int)ceil<milliseconds>(entry.second.deadline - now).count();
+            until_deadline = std::max(until_deadline, 0);
+
+            if (timeout_ms < 0 || until_deadline < timeout_ms) {
+                timeout_ms = until_deadline;
+            }
+        }
+    }
+
+    epoll_event events[32];
+    int count = epoll_wait(epoll_fd_, events, 32, timeout_ms);
+
+    for (int i = 0; i < count; i++) {
+        Connection &connection = *static_cast<Connection *>(events[i].data.ptr);
+
+        if (connection.broken) {
+            continue;
+        }
+
+        if (events[i].events & EPOLLIN) {
+            receive(connection);
+        }
+        if (!connection.broken && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+            fail(connection, "Socket error");
+        }
+        if (!connection.broken && (events[i].events & EPOLLOUT)) {
+            flush(connection);
+        }
+    }
+
+    expire(steady_clock::now());
+    runCallbacks();
+}
+
+void MotorBus::run() {
+    // Callbacks may submit more, which keeps the loop going
+    while (true) {
+        runCallbacks();
+
+        if (pending_ == 0) {
+            break;
+        }
+
+        poll(-1);
+    }
+}
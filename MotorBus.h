@@ -0,0 +1,140 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "MotorController.h"
+
+// Drives the Modbus sockets of many MotorControllers from one epoll loop so a slow
+// drive only delays its own requests. While a motor is attached the bus owns its
+// socket and the motor's blocking calls must not be used.
+//
+// With a pipeline depth above one, up to that many transactions are kept on the wire
+// per socket and matched back by transaction ID, and motors that share an address and
+// port (several slave IDs behind one gateway) share a single socket.
+//
+// A connection that fails stays broken until its motor is added again, which picks up
+// the socket the motor's supervisor has reconnected with.
+//
+// Callbacks only run from poll() and run(), after the pass over the sockets, so they may
+// submit, add and remove motors. Requests completed elsewhere (a failed submit, remove())
+// are reported on the next poll().
+class MotorBus {
+    public:
+        using ReadCallback = std::function<void (bool ok, const uint16_t *data, int count)>;
+        using WriteCallback = std::function<void (bool ok)>;
+        using SnapshotCallback = std::function<void (bool ok, const MotorController::MotorState &state)>;
+
+        struct GroupTarget {
+            MotorController *motor;
+            int32_t position;
+        };
+
+        // Times are relative to the first target leaving. A drive starts somewhere between its
+        // target being sent and acknowledged, so start skew is estimated from the midpoints
+        struct GroupMoveReport {
+            bool ok = false;
+            std::vector<uint64_t> sent_ns;
+            std::vector<uint64_t> acked_ns;
+            uint64_t send_skew_ns = 0;
+            uint64_t ack_skew_ns = 0;
+            uint64_t start_skew_ns = 0;
+        };
+
+        explicit MotorBus(std::chrono::milliseconds request_timeout = std::chrono::milliseconds(250),
+                          size_t pipeline_depth = 1);
+        ~MotorBus();
+
+        MotorBus(const MotorBus&) = delete;
+        MotorBus& operator=(const MotorBus&) = delete;
+
+        bool add(MotorController &motor);
+        void remove(MotorController &motor);
+
+        bool submitRead(MotorController &motor, int address, int count, ReadCallback callback);
+        bool submitWrite(MotorController &motor, int address, const uint16_t *values, int count, WriteCallback callback);
+        // False if nothing could be submitted. Otherwise callback runs exactly once, with ok
+        // false if any span failed or couldn't be queued
+        bool submitSnapshot(MotorController &motor, SnapshotCallback callback);
+
+        // Snapshots every attached motor at once, states are in the order the motors were added
+        bool snapshotAll(std::vector<MotorController::MotorState> &states);
+
+        // Sets every target position at once: all frames are encoded and queued first, then
+        // written to every socket in one pass, so the group starts within about one round trip
+        // instead of one per motor. Motors sharing a gateway socket need a pipeline depth of at
+        // least their count to go out together
+        bool moveAll(const std::vector<GroupTarget> &targets, GroupMoveReport &report);
+
+        // Waits up to timeout_ms for socket events and completes whatever is ready
+        void poll(int timeout_ms);
+        // Runs the loop until every submitted request has completed or timed out
+        void run();
+
+        size_t pending() const { return pending_; }
+
+    private:
+        struct Request {
+            std::vector<uint8_t> frame;
+            int count; // Registers expected back, 0 for writes
+            ReadCallback on_read;
+            WriteCallback on_write;
+            uint16_t transaction_id;
+            std::chrono::steady_clock::time_point deadline;
+            uint64_t *sent_ns = nullptr; // Stamped when the frame is handed to the socket
+        };
+
+        // A finished request waiting for its callback
+        struct Completion {
+            Request request;
+            bool ok;
+            uint16_t data[MODBUS_MAX_READ_REGISTERS];
+        };
+
+        struct Connection {
+            // The first motor owns the socket, the rest are other slaves behind the same gateway
+            std::vector<MotorController *> motors;
+            int fd;
+            int saved_flags;
+            bool broken = false;
+            bool watching_write = false;
+            uint16_t next_transaction_id = 1;
+
+            std::deque<Request> queued;
+            std::unordered_map<uint16_t, Request> in_flight;
+
+            std::vector<uint8_t> tx;
+            size_t tx_offset = 0;
+            std::vector<uint8_t> rx;
+        };
+
+        int epoll_fd_;
+        std::chrono::milliseconds request_timeout_;
+        size_t pipeline_depth_;
+        std::vector<std::unique_ptr<Connection>> connections_;
+        std::vector<MotorController *> motors_;
+        size_t pending_ = 0;
+        std::vector<Completion> completed_;
+        // While set, dispatched frames are buffered but not sent
+        bool holding_ = false;
+
+        Connection *find(const MotorController &motor);
+        Connection *findGateway(const MotorController &motor);
+        void close(Connection &connection);
+        bool enqueue(Connection &connection, Request request);
+        void dispatch(Connection &connection);
+        void flush(Connection &connection);
+        void receive(Connection &connection);
+        void complete(Request &request, bool ok, const uint16_t *data);
+        void defer(Request &request, bool ok, const uint16_t *data);
+        void runCallbacks();
+        void fail(Connection &connection, const char *reason);
+        void failPending(Connection &connection);
+        void expire(std::chrono::steady_clock::time_point now);
+        void updateInterest(Connection &connection);
+};
@@ -1,200 +1,327 @@
-#include <iostream>
-#include <sstream> 
-#include <fstream>
+#include <sstream>
 #include <unordered_map>
 #include <functional>
+#include <algorithm>
 #include <errno.h>
+#include <cmath>
+#include <cstdlib>
 
 #include "MotorController.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Utils.h"
 
-MotorController::MotorController(const std::string &profile_path, const std::string &ip_address, int port, int slave_id) {
+MotorController::MotorController(const std::string &profile_path, const std::string &ip_address, int port, int slave_id)
+    : profile_(std::make_shared<MotorProfile>()) {
     ip_address_ = ip_address;
     port_ = port;
     slave_id_ = slave_id;
+    profile_path_ = profile_path;
     
     loadProfile(profile_path);
 }
 
 MotorController::~MotorController() {
+    // Joined outside the lock, the waiter takes it to hand out callbacks
+    std::thread move_waiter;
+    {
+        std::lock_guard<std::mutex> lock(move_waiter_mutex_);
+        move_stopping_ = true;
+        move_waiter = std::move(move_waiter_);
+    }
+
+    move_waiter_cv_.notify_all();
+    if (move_waiter.joinable()) {
+        move_waiter.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ctx_mutex_);
+        stopping_ = true;
+    }
+
+    link_cv_.notify_all();
+    if (supervisor_.joinable()) {
+        supervisor_.join();
+    }
+
     if (ctx_) {
         modbus_close(ctx_);
         modbus_free(ctx_);
 
         ctx_ = nullptr;
-        std::cout << INFO_PREFIX << " Modbux Connection Closed" << std::endl;
+        Log::info("Modbux Connection Closed");
     }
 }
 
 bool MotorController::connect() {
-    ctx_ = modbus_new_tcp(ip_address_.c_str(), port_);
+    Log::info("Attemtping to connect to ", ip_address_, ":", port_);
 
-    if (!ctx_) {
-        logError("Failed to create Modbus context");
+    modbus_t *ctx = openContext(true);
+
+    if (!ctx) {
         return false;
     }
 
-    modbus_set_slave(ctx_, slave_id_);
-
-    std::cout << INFO_PREFIX << " Attemtping to connect to " << ip_address_ << ":" << port_ << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(ctx_mutex_);
+        ctx_ = ctx;
+        supervised_ = true;
+    }
 
-    if (modbus_connect(ctx_) == -1) {
-        logError("Modbus connection failed");
-        modbus_free(ctx_);
-        ctx_ = nullptr;
-        return false;
+    if (!supervisor_.joinable()) {
+        supervisor_ = std::thread(&MotorController::supervise, this);
     }
 
-    std::cout << INFO_PREFIX << " Successfully connected to motor" << std::endl;
+    Log::info("Successfully connected to motor");
     return true;
 }
 
-bool MotorController::loadProfile(const std::string &profile_path) {
-    std::ifstream file(profile_path);
+bool MotorController::isConnected() const {
+    std::lock_guard<std::mutex> lock(ctx_mutex_);
+    return ctx_ != nullptr;
+}
 
-    if (!file.is_open()) {
-        logError("Couldn't open the profile file");
-        return false;
+modbus_t *MotorController::openContext(bool log_failure) const {
+    modbus_t *ctx = modbus_new_tcp(ip_address_.c_str(), port_);
+
+    if (!ctx) {
+        logError("Failed to create Modbus context", errno);
+        return nullptr;
     }
 
-    std::string text;
-    std::string current_table = "";
-    std::string current_key = "";
-    while (file >> text) {
-        if (text[0] == '[') {
-            current_table = text;
-            continue;
+    modbus_set_slave(ctx, slave_id_);
+
+    if (modbus_connect(ctx) == -1) {
+        if (log_failure) {
+            logError("Modbus connection failed", errno);
         }
+        modbus_free(ctx);
+        return nullptr;
+    }
 
-        if (current_key == "") {
-            current_key = text;
-            continue;
+    return ctx;
+}
+
+void MotorController::supervise() {
+    std::unique_lock<std::mutex> lock(ctx_mutex_);
+    auto backoff = RECONNECT_BACKOFF_MIN;
+
+    while (true) {
+        link_cv_.wait(lock, [this] { return !ctx_ || stopping_; });
+
+        if (stopping_) {
+            return;
         }
 
-        if (text[0] == '=') {
-            file >> text;
+        lock.unlock();
+        modbus_t *ctx = openContext(false);
+
+        // A rebooted drive has forgotten its target, so the last commanded one is sent again
+        if (ctx && has_target_) {
+            uint16_t data[2];
+            int32_t target = last_target_;
+            data[0] = (uint16_t)(target);
+            data[1] = (uint16_t)(target >> 16);
+
+            if (modbus_write_registers(ctx, currentProfile()->position, 2, data) == -1) {
+                modbus_close(ctx);
+                modbus_free(ctx);
+                ctx = nullptr;
+            }
         }
+        lock.lock();
 
-        static const std::unordered_map<std::string, std::function<void (const std::string&)>> registers_key_handlers = {
-            {"read-axis-velocity", [&](const std::string& val_text) {
-                READ_AXIS_VELOCITY_START = std::stoul(val_text, nullptr, 16);
-            }},
-            {"microstep-resolution", [&](const std::string& val_text) {
-                MICROSTEP_RESOLUTION_ADDRESS = std::stoul(val_text, nullptr, 16);
-            }},
-            {"moving-flag", [&](const std::string& val_text) {
-                MOVING_FLAG_ADDRESS = std::stoul(val_text, nullptr, 16);
-            }},
-            {"position", [&](const std::string& val_text) {
-                ABS_POSITION_REGISTER_START = std::stoul(val_text, nullptr, 16);
-            }},
-            {"save-settings", [&](const std::string& val_text) {
-                SAVE_SETTINGS_REGISTER = std::stoul(val_text, nullptr, 16);
-            }},
-            {"initial-velocity", [&](const std::string& val_text) {
-                INITIAL_VELOCITY_REGISTER_START = std::stoul(val_text, nullptr, 16);
-            }},
-            {"max-velocity", [&](const std::string& val_text) {
-                MAX_VELOCITY_REGISTER_START = std::stoul(val_text, nullptr, 16);
-            }}
-        };
-
-        static const std::unordered_map<std::string, std::function<void (const std::string&)>> limits_key_handlers = {
-            {"max-velocity", [&](const std::string& val_text) {
-                MAX_VELOCITY = std::stoi(val_text);
-            }},
-        };
-
-        std::unordered_map<std::string, std::function<void (const std::string&)>> handlers;
-        if (current_table == "[registers]") {
-            handlers = registers_key_handlers;
-        } else if (current_table == "[limits]") {
-            handlers = limits_key_handlers;
-        } else {
+        if (!ctx) {
+            link_cv_.wait_for(lock, backoff, [this] { return stopping_; });
+            backoff = std::min(backoff * 2, RECONNECT_BACKOFF_MAX);
             continue;
         }
 
-        auto it = handlers.find(current_key);
-        if (it != handlers.end()) {
-            it->second(text);
-        } else {
-            std::cerr << WARNING_PREFIX << " Unknown configuration key: " << current_key << std::endl;
+        if (stopping_) {
+            modbus_close(ctx);
+            modbus_free(ctx);
+            return;
         }
 
-        current_key = "";
-    }
+        ctx_ = ctx;
+        backoff = RECONNECT_BACKOFF_MIN;
 
-    return true;
+        // The drive may have been power cycled or reconfigured while we were away
+        invalidateCache();
+        Log::info("Reconnected to ", ip_address_, ":", port_);
+
+        link_cv_.notify_all();
+    }
 }
 
-bool MotorController::readFlag(int address, bool &value) const {
+// Caller holds ctx_mutex_
+void MotorController::dropLink() const {
     if (!ctx_) {
-        logError("Cannot read flag: Not connected");
-        return false;
+        return;
     }
 
-    uint8_t status[1];
-    std::cout << address << " -- err: ";
-    int rc = modbus_read_input_bits(ctx_, address, 1, status);
-    std::cout << rc << std::endl;
+    Log::warning("Lost connection to ", ip_address_, ":", port_, ", reconnecting");
 
-    if (rc == -1) {
-        logError("Failed to read flag status");
+    modbus_close(ctx_);
+    modbus_free(ctx_);
+    ctx_ = nullptr;
+
+    link_cv_.notify_all();
+}
+
+void MotorController::reportLinkFailure(int socket) const {
+    std::lock_guard<std::mutex> lock(ctx_mutex_);
+
+    if (ctx_ && modbus_get_socket(ctx_) == socket) {
+        dropLink();
+    }
+}
+
+static bool isLinkFailure(int error) {
+    switch (error) {
+        case ECONNRESET:
+        case ECONNABORTED:
+        case ECONNREFUSED:
+        case EPIPE:
+        case ETIMEDOUT:
+        case ENOTCONN:
+        case EBADF:
+        case EHOSTUNREACH:
+        case ENETUNREACH:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool MotorController::request(const std::string &error_message, bool idempotent, const std::function<int (modbus_t *ctx)> &call) const {
+    std::unique_lock<std::mutex> lock(ctx_mutex_);
+    auto deadline = std::chrono::steady_clock::now() + REPLAY_TIMEOUT;
+
+    if (!currentProfile()->loaded) {
+        logError(error_message + ": No motor profile loaded");
         return false;
     }
 
-    value = (status[0] == 1);
-    return true;
+    while (true) {
+        if (ctx_) {
+            if (call(ctx_) != -1) {
+                return true;
+            }
+
+            int error = errno;
+            logError(error_message, error);
+
+            if (!supervised_ || !isLinkFailure(error)) {
+                return false;
+            }
+
+            dropLink();
+        } else if (!supervised_ || !idempotent) {
+            logError(error_message + ": Not connected");
+            return false;
+        }
+
+        // Wait for the supervisor to bring the link back, then replay
+        if (!idempotent || !link_cv_.wait_until(lock, deadline, [this] { return ctx_ || stopping_; }) || stopping_) {
+            return false;
+        }
+    }
 }
 
-bool MotorController::read8BitRegister(int address, int8_t &value) const {
-    if (!ctx_) {
-        logError("Cannot read: Not connected");
+bool MotorController::loadProfile(const std::string &profile_path) {
+    std::string error;
+    std::string warnings;
+    std::shared_ptr<const MotorProfile> profile = MotorProfile::load(profile_path, error, warnings);
+
+    std::istringstream warning_stream(warnings);
+    for (std::string line; std::getline(warning_stream, line);) {
+        Log::warning(line);
+    }
+
+    if (!profile) {
+        logError(error);
         return false;
     }
 
-    uint8_t data[1];
-    int rc = modbus_read_bits(ctx_, address, 1, data);
+    std::atomic_store(&profile_, profile);
+    return true;
+}
+
+bool MotorController::reloadProfile() {
+    std::shared_ptr<const MotorProfile> previous = currentProfile();
 
-    if (rc == -1) {
-        logError("Failed to read 8-bit register");
+    // A profile that fails to load or validate leaves the current one in place
+    if (!loadProfile(profile_path_)) {
         return false;
     }
 
-    value = (int8_t)data[0];
+    // Profiles are shared per file version, so an unchanged file gives back the same one
+    if (currentProfile() != previous) {
+        // Cached values may have been read through registers the new profile has moved
+        invalidateCache();
+        Log::info("Reloaded motor profile ", profile_path_);
+    }
 
     return true;
 }
 
-bool MotorController::write8BitRegister(int address, int8_t value) {
-    if (!ctx_) {
-        logError("Cannot write: Not connected");
+// Flags are holding registers like the rest of the status, so they decode the same as in a snapshot
+bool MotorController::readFlag(int address, bool &value) const {
+    uint16_t status[1];
+    uint64_t start = Utils::monotonicNs();
+
+    bool ok = request("Failed to read flag status", true, [&](modbus_t *ctx) {
+        return modbus_read_registers(ctx, address, 1, status);
+    });
+
+    Metrics::recordSince(Metrics::Op::MODBUS_READ_FLAG, start, ok);
+
+    if (!ok) {
         return false;
     }
 
+    value = (status[0] != 0);
+    return true;
+}
+
+bool MotorController::read8BitRegister(int address, int8_t &value) const {
     uint8_t data[1];
-    data[0] = (uint8_t)value;
 
-    int rc = modbus_write_bits(ctx_, address, 1, data);
+    bool ok = request("Failed to read 8-bit register", true, [&](modbus_t *ctx) {
+        return modbus_read_bits(ctx, address, 1, data);
+    });
 
-    if (rc == -1) {
-        logError("Failed to write 8-bit register");
+    if (!ok) {
         return false;
     }
 
+    value = (int8_t)data[0];
+
     return true;
 }
 
-bool MotorController::read32BitRegister(int address, int32_t &value) const {
-    if (!ctx_) {
-        logError("Cannot read: Not connected");
-        return false;
-    }
+bool MotorController::write8BitRegister(int address, int8_t value) {
+    uint8_t data[1];
+    data[0] = (uint8_t)value;
+
+    return request("Failed to write 8-bit register", true, [&](modbus_t *ctx) {
+        return modbus_write_bits(ctx, address, 1, data);
+    });
+}
 
+bool MotorController::read32BitRegister(int address, int32_t &value) const {
     uint16_t data[2];
-    int rc = modbus_read_registers(ctx_, address, 2, data);
+    uint64_t start = Utils::monotonicNs();
+
+    bool ok = request("Failed to read 32-bit registers", true, [&](modbus_t *ctx) {
+        return modbus_read_registers(ctx, address, 2, data);
+    });
+
+    Metrics::recordSince(Metrics::Op::MODBUS_READ_32, start, ok);
 
-    if (rc == -1) {
-        logError("Failed to read 32-bit registers");
+    if (!ok) {
         return false;
     }
 
@@ -204,39 +331,286 @@ bool MotorController::read32BitRegister(int address, int32_t &value) const {
 }
 
 bool MotorController::write32BitRegister(int address, int32_t value) {
-    if (!ctx_) {
-        logError("Cannot write: Not connected");
-        return false;
-    }
-
     uint16_t data[2];
 
     // Split 32-bit integer into two 16-bit values (big endian)
     data[0] = (uint16_t)(value);
     data[1] = (uint16_t)(value >> 16);
 
-    int rc = modbus_write_registers(ctx_, address, 2, data);
+    uint64_t start = Utils::monotonicNs();
 
-    if (rc == -1) {
-        logError("Failed to write 32-bit registers");
-        return false;
-    }
+    // Plain register writes are absolute, so replaying one after a reconnect is safe
+    bool ok = request("Failed to write 32-bit registers", true, [&](modbus_t *ctx) {
+        return modbus_write_registers(ctx, address, 2, data);
+    });
 
-    return true;
+    Metrics::recordSince(Metrics::Op::MODBUS_WRITE_32, start, ok);
+    return ok;
 }
 
 bool MotorController::isMoving() {
-    bool flag;
-    
-    readFlag(MOVING_FLAG_ADDRESS, flag);
+    int32_t cached;
+    uint64_t generation;
+
+    if (readCache(Cached::MOVING, cached, generation)) {
+        return cached != 0;
+    }
+
+    // Like the other getters, a failed read reports the zero value
+    bool flag = false;
+
+    if (readFlag(currentProfile()->moving_flag, flag)) {
+        fillCache(Cached::MOVING, flag, generation);
+    }
 
     return flag;
 }
 
+bool MotorController::snapshot(MotorState &state) const {
+    return snapshot(*currentProfile(), state);
+}
+
+// Spans and decoding come from the one profile so a swap meanwhile can't mix them
+bool MotorController::snapshot(const MotorProfile &profile, MotorState &state) const {
+    uint16_t data[MODBUS_MAX_READ_REGISTERS];
+    MotorState result;
+    StatusGenerations generations = statusGenerations();
+
+    for (const MotorProfile::RegisterSpan &span : profile.snapshot_spans) {
+        bool ok = request("Failed to read register snapshot", true, [&](modbus_t *ctx) {
+            return modbus_read_registers(ctx, span.start, span.count, data);
+        });
+
+        if (!ok) {
+            return false;
+        }
+
+        decodeSnapshotSpan(profile, span, data, result);
+    }
+
+    fillStatusCache(result, generations);
+    state = result;
+    return true;
+}
+
+void MotorController::decodeSnapshotSpan(const MotorProfile &profile, const MotorProfile::RegisterSpan &span, const uint16_t *data, MotorState &state) const {
+    auto decode32 = [&](int address, int32_t &value) {
+        if (address >= span.start && address + 2 <= span.start + span.count) {
+            int offset = address - span.start;
+            value = (int32_t)(((uint32_t)data[offset] << 16) | data[offset + 1]);
+        }
+    };
+
+    decode32(profile.position, state.position);
+    decode32(profile.read_axis_velocity, state.velocity);
+    decode32(profile.initial_velocity, state.initial_velocity);
+    decode32(profile.max_velocity, state.max_velocity);
+
+    if (profile.moving_flag >= span.start && profile.moving_flag < span.start + span.count) {
+        state.moving = data[profile.moving_flag - span.start] != 0;
+    }
+}
+
+double MotorController::estimateMoveSeconds(double distance, double initial_velocity, double max_velocity, double acceleration) {
+    if (acceleration <= 0) {
+        return distance / max_velocity;
+    }
+
+    double ramp_seconds = (max_velocity - initial_velocity) / acceleration;
+    double ramp_distance = (initial_velocity + max_velocity) / 2 * ramp_seconds;
+
+    if (2 * ramp_distance <= distance) {
+        return 2 * ramp_seconds + (distance - 2 * ramp_distance) / max_velocity;
+    }
+
+    double peak_velocity = std::sqrt(initial_velocity * initial_velocity + acceleration * distance);
+    return 2 * (peak_velocity - initial_velocity) / acceleration;
+}
+
+// The inverse of estimateMoveSeconds: the acceleration that makes a move of distance take seconds
+static double accelerationFor(double distance, double initial_velocity, double max_velocity, double seconds) {
+    if (seconds * max_velocity > distance) {
+        double acceleration = (max_velocity - initial_velocity) * (max_velocity - initial_velocity) / (seconds * max_velocity - distance);
+        double ramp_distance = (initial_velocity + max_velocity) / 2 * (max_velocity - initial_velocity) / acceleration;
+
+        if (2 * ramp_distance <= distance) {
+            return acceleration;
+        }
+    }
+
+    return seconds > 0 && distance > seconds * initial_velocity ? 4 * (distance - seconds * initial_velocity) / (seconds * seconds) : 0;
+}
+
+bool MotorController::waitForMove(std::chrono::milliseconds timeout, MoveWaitReport *report) {
+    using namespace std::chrono;
+
+    std::shared_ptr<const MotorProfile> profile = currentProfile();
+
+    MoveWaitReport result;
+    const uint64_t start_ns = Utils::monotonicNs();
+    const uint64_t timeout_ns = start_ns + duration_cast<nanoseconds>(timeout).count();
+
+    auto finish = [&](bool completed) {
+        result.completed = completed;
+        result.elapsed_ns = Utils::monotonicNs() - start_ns;
+        if (report) {
+            *report = result;
+        }
+        return completed;
+    };
+
+    // One snapshot gives the distance left and the velocities to cover it at
+    MotorState state;
+    result.reads += profile->snapshot_spans.size();
+    if (!snapshot(*profile, state)) {
+        return finish(false);
+    }
+
+    int64_t remaining = has_target_ ? std::abs((int64_t)last_target_ - state.position) : 0;
+    if (!state.moving && remaining == 0) {
+        return finish(true);
+    }
+
+    double initial_velocity = std::max(state.initial_velocity, 1);
+    double max_velocity = std::max<double>(state.max_velocity, initial_velocity);
+    double acceleration = move_acceleration_;
+
+    if (state.max_velocity > 0) {
+        double seconds;
+
+        if (state.moving && acceleration > 0) {
+            // Part way through: cruise what is left beyond the deceleration, then decelerate
+            double velocity = std::clamp<double>(std::abs(state.velocity), initial_velocity, max_velocity);
+            double decel_distance = (velocity * velocity - initial_velocity * initial_velocity) / (2 * acceleration);
+            seconds = std::max(remaining - decel_distance, 0.0) / max_velocity + (velocity - initial_velocity) / acceleration;
+        } else {
+            seconds = estimateMoveSeconds(remaining, initial_velocity, max_velocity, acceleration);
+        }
+
+        result.predicted_ns = (uint64_t)(seconds * 1e9);
+    }
+
+    uint64_t lead_ns = duration_cast<nanoseconds>(MOVE_WAKE_LEAD).count() + 2 * move_eta_error_ns_;
+    if (result.predicted_ns > lead_ns) {
+        if (!sleepForMove(std::min(start_ns + result.predicted_ns - lead_ns, timeout_ns))) {
+            return finish(false);
+        }
+    }
+
+    const uint64_t grace_ns = start_ns + duration_cast<nanoseconds>(MOVE_START_GRACE).count();
+    bool started = state.moving;
+
+    while (true) {
+        bool moving;
+        result.reads++;
+
+        if (!readFlag(profile->moving_flag, moving)) {
+            return finish(false);
+        }
+
+        uint64_t now = Utils::monotonicNs();
+        started = started || moving;
+
+        if (!moving && (started || now >= grace_ns)) {
+            break;
+        } else if (now >= timeout_ns) {
+            return finish(false);
+        }
+
+        if (!sleepForMove(Utils::monotonicNs() + duration_cast<nanoseconds>(MOVE_POLL_INTERVAL).count())) {
+            return finish(false);
+        }
+    }
+
+    finish(true);
+
+    // Whole moves, waited for from before they started, teach the acceleration and how far off the prediction was
+    if (state.max_velocity > 0 && !state.moving && started && remaining > 0) {
+        double observed = accelerationFor(remaining, initial_velocity, max_velocity, result.elapsed_ns / 1e9);
+
+        if (observed > 0) {
+            move_acceleration_ = acceleration > 0 ? (uint64_t)((acceleration * 3 + observed) / 4) : (uint64_t)observed;
+        }
+
+        if (acceleration > 0) {
+            uint64_t error_ns = result.elapsed_ns > result.predicted_ns ? result.elapsed_ns - result.predicted_ns
+                                                                       : result.predicted_ns - result.elapsed_ns;
+            move_eta_error_ns_ = (move_eta_error_ns_ * 3 + error_ns) / 4;
+        }
+    }
+
+    return true;
+}
+
+bool MotorController::sleepForMove(uint64_t deadline_ns) {
+    using namespace std::chrono;
+
+    std::unique_lock<std::mutex> lock(move_waiter_mutex_);
+    return !move_waiter_cv_.wait_until(lock, steady_clock::time_point(nanoseconds(deadline_ns)), [this] { return move_stopping_; });
+}
+
+void MotorController::onMoveComplete(MoveCallback callback, std::chrono::milliseconds timeout) {
+    {
+        std::lock_guard<std::mutex> lock(move_waiter_mutex_);
+
+        if (move_stopping_) {
+            return;
+        }
+
+        // The first callback of a wait sets its timeout
+        if (move_callbacks_.empty()) {
+            move_callback_timeout_ = timeout;
+        }
+
+        move_callbacks_.push_back(std::move(callback));
+
+        if (!move_waiter_.joinable()) {
+            move_waiter_ = std::thread(&MotorController::runMoveWaiter, this);
+        }
+    }
+
+    move_waiter_cv_.notify_all();
+}
+
+void MotorController::runMoveWaiter() {
+    std::unique_lock<std::mutex> lock(move_waiter_mutex_);
+
+    while (true) {
+        move_waiter_cv_.wait(lock, [this] { return move_stopping_ || !move_callbacks_.empty(); });
+
+        if (move_callbacks_.empty()) {
+            return;
+        }
+
+        std::chrono::milliseconds timeout = move_callback_timeout_;
+        lock.unlock();
+
+        bool completed = waitForMove(timeout);
+
+        // Callbacks registered during the wait share it, ones registered by these start the next
+        std::vector<MoveCallback> callbacks;
+        lock.lock();
+        callbacks.swap(move_callbacks_);
+        lock.unlock();
+
+        for (const MoveCallback &callback : callbacks) {
+            callback(completed);
+        }
+
+        lock.lock();
+    }
+}
+
 int32_t MotorController::getCurrentPosition() const {
     int32_t current_position;
+    uint64_t generation;
 
-    if (read32BitRegister(ABS_POSITION_REGISTER_START, current_position)) {
+    if (readCache(Cached::POSITION, current_position, generation)) {
+        return current_position;
+    }
+
+    if (read32BitRegister(currentProfile()->position, current_position)) {
+        fillCache(Cached::POSITION, current_position, generation);
         return current_position;
     } else {
         return 0;
@@ -245,8 +619,14 @@ int32_t MotorController::getCurrentPosition() const {
 
 int32_t MotorController::getCurrentVelocity() const {
     int32_t current_velocity;
+    uint64_t generation;
+
+    if (readCache(Cached::VELOCITY, current_velocity, generation)) {
+        return current_velocity;
+    }
 
-    if (read32BitRegister(READ_AXIS_VELOCITY_START, current_velocity)) {
+    if (read32BitRegister(currentProfile()->read_axis_velocity, current_velocity)) {
+        fillCache(Cached::VELOCITY, current_velocity, generation);
         return current_velocity;
     } else {
         return 0;
@@ -254,9 +634,17 @@ int32_t MotorController::getCurrentVelocity() const {
 }
 
 int8_t MotorController::getCurrentMicrostepResolution() const {
+    int32_t cached;
+    uint64_t generation;
+
+    if (readCache(Cached::MICROSTEP_RESOLUTION, cached, generation)) {
+        return (int8_t)cached;
+    }
+
     int8_t current_microstep_resolution;
 
-    if (read8BitRegister(MICROSTEP_RESOLUTION_ADDRESS, current_microstep_resolution)) {
+    if (read8BitRegister(currentProfile()->microstep_resolution, current_microstep_resolution)) {
+        fillCache(Cached::MICROSTEP_RESOLUTION, current_microstep_resolution, generation);
         return current_microstep_resolution;
     } else {
         return 0;
@@ -264,9 +652,19 @@ int8_t MotorController::getCurrentMicrostepResolution() const {
 }
 
 int32_t MotorController::getInitialVelocity() const {
+    return getInitialVelocity(*currentProfile());
+}
+
+int32_t MotorController::getInitialVelocity(const MotorProfile &profile) const {
     int32_t initial_velocity;
+    uint64_t generation;
 
-    if (read32BitRegister(INITIAL_VELOCITY_REGISTER_START, initial_velocity)) {
+    if (readCache(Cached::INITIAL_VELOCITY, initial_velocity, generation)) {
+        return initial_velocity;
+    }
+
+    if (read32BitRegister(profile.initial_velocity, initial_velocity)) {
+        fillCache(Cached::INITIAL_VELOCITY, initial_velocity, generation);
         return initial_velocity;
     } else {
         return 0;
@@ -274,9 +672,19 @@ int32_t MotorController::getInitialVelocity() const {
 }
 
 int32_t MotorController::getMaxVelocity() const {
+    return getMaxVelocity(*currentProfile());
+}
+
+int32_t MotorController::getMaxVelocity(const MotorProfile &profile) const {
     int32_t max_velocity;
+    uint64_t generation;
+
+    if (readCache(Cached::MAX_VELOCITY, max_velocity, generation)) {
+        return max_velocity;
+    }
 
-    if (read32BitRegister(MAX_VELOCITY_REGISTER_START, max_velocity)) {
+    if (read32BitRegister(profile.max_velocity, max_velocity)) {
+        fillCache(Cached::MAX_VELOCITY, max_velocity, generation);
         return max_velocity;
     } else {
         return 0;
@@ -284,94 +692,199 @@ int32_t MotorController::getMaxVelocity() const {
 }
 
 bool MotorController::setMicrostepResolution(int8_t microstep_resolution) {
-    std::cout << INFO_PREFIX << " Setting microstep resolution to: " << microstep_resolution << std::endl;
-    return write8BitRegister(MICROSTEP_RESOLUTION_ADDRESS, microstep_resolution);
+    Log::info("Setting microstep resolution to: ", microstep_resolution);
+
+    if (!write8BitRegister(currentProfile()->microstep_resolution, microstep_resolution)) {
+        return false;
+    }
+
+    writeCache(Cached::MICROSTEP_RESOLUTION, microstep_resolution);
+    return true;
 }
 
 bool MotorController::setAbsolutePosition(int32_t target_position) {
-    std::cout << INFO_PREFIX << " Setting target position to: " << target_position << std::endl;
-    return write32BitRegister(ABS_POSITION_REGISTER_START, target_position);
+    Log::info("Setting target position to: ", target_position);
+
+    last_target_ = target_position;
+    has_target_ = true;
+
+    dropCache(Cached::POSITION);
+    dropCache(Cached::MOVING);
+
+    return write32BitRegister(currentProfile()->position, target_position);
 }
 
 bool MotorController::saveSettings() {
-    if (!ctx_) {
-        logError("Cannot save settings: Not connected");
-        return false;
-    }
-
-    std::cout << INFO_PREFIX << " Saving all parameters" << std::endl;
+    Log::info("Saving all parameters");
 
-    int rc = modbus_write_register(ctx_, SAVE_SETTINGS_REGISTER, 1);
+    // Not replayed: the drive may already have committed the first write to flash
+    bool ok = request("Failed to write to Save Settings register", false, [&](modbus_t *ctx) {
+        return modbus_write_register(ctx, currentProfile()->save_settings, 1);
+    });
 
-    if (rc == -1) {
-        logError("Failed to write to Save Settings register");
+    if (!ok) {
         return false;
     }
 
-    std::cout << INFO_PREFIX << " Save command successfuly" << std::endl;
+    Log::info("Save command successfuly");
+
+    // The drive may normalise values as it commits them
+    invalidateCache();
 
     return true;
 }
 
 bool MotorController::setInitialVelocity(int32_t initial_velocity) {
-    std::cout << INFO_PREFIX << " Setting initial velocity to: " << initial_velocity << std::endl;
+    std::shared_ptr<const MotorProfile> profile = currentProfile();
+
+    Log::info("Setting initial velocity to: ", initial_velocity);
 
-    int32_t current_max_velocity = getMaxVelocity();
+    int32_t current_max_velocity = getMaxVelocity(*profile);
 
-    std::stringstream error_stream;
     if (initial_velocity < 1) {
-        error_stream << "Attempted to set initial velocity to " << initial_velocity << ", minimum value is " << 1;
-        logError(error_stream);
+        Log::error("Attempted to set initial velocity to ", initial_velocity, ", minimum value is ", 1);
         
         return false;
     } else if (initial_velocity > current_max_velocity - 1) {
-        error_stream << "Attempted to set initial velocity to " << initial_velocity << ", maximum value is " << current_max_velocity - 1;
-        logError(error_stream);
+        Log::error("Attempted to set initial velocity to ", initial_velocity, ", maximum value is ", current_max_velocity - 1);
         
         return false;
     }
 
-    return write32BitRegister(INITIAL_VELOCITY_REGISTER_START, initial_velocity);
+    if (!write32BitRegister(profile->initial_velocity, initial_velocity)) {
+        return false;
+    }
+
+    writeCache(Cached::INITIAL_VELOCITY, initial_velocity);
+    return true;
 }
 
 bool MotorController::setMaxVelocity(int32_t max_velocity) {
-    std::cout << INFO_PREFIX << " Setting max velocity to: " << max_velocity << std::endl;
+    std::shared_ptr<const MotorProfile> profile = currentProfile();
 
-    int32_t current_initial_velocity = getInitialVelocity();
+    Log::info("Setting max velocity to: ", max_velocity);
+
+    int32_t current_initial_velocity = getInitialVelocity(*profile);
 
-    std::stringstream error_stream;
     if (max_velocity < current_initial_velocity + 1) {
-        error_stream << "Attempted to set max velocity to " << max_velocity << ", the minimum value is " << current_initial_velocity + 1;
-        logError(error_stream);
+        Log::error("Attempted to set max velocity to ", max_velocity, ", the minimum value is ", current_initial_velocity + 1);
+
+        return false;
+    } else if (max_velocity > profile->max_velocity_limit) {
+        Log::error("Attempted to set max velocity to ", max_velocity, ", the maximum value is ", profile->max_velocity_limit);
 
         return false;
-    } else if (max_velocity > MAX_VELOCITY) {
-        error_stream << "Attempted to set max velocity to " << max_velocity << ", the maximum value is " << MAX_VELOCITY;
-        logError(error_stream);
+    }
 
+    if (!write32BitRegister(profile->max_velocity, max_velocity)) {
         return false;
     }
 
-    return write32BitRegister(MAX_VELOCITY_REGISTER_START, max_velocity);
+    writeCache(Cached::MAX_VELOCITY, max_velocity);
+    return true;
 }
 
-void MotorController::logError(const std::string &message) const {
-    std::stringstream stream;
+int32_t MotorController::getMaxVelocityLimit() const {
+    return currentProfile()->max_velocity_limit;
+}
 
-    stream << message << std::endl;
+void MotorController::setMaxStatusAge(std::chrono::microseconds max_age) {
+    max_status_age_ns_ = std::chrono::duration_cast<std::chrono::nanoseconds>(max_age).count();
+}
+
+void MotorController::invalidateCache() {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
 
-    logError(stream);
+    for (CacheEntry &entry : cache_) {
+        entry.valid = false;
+        entry.generation++;
+    }
 }
 
-void MotorController::logError(std::stringstream &message_stream) const {
-    std::string stream_string;
+bool MotorController::readCache(Cached reg, int32_t &value, uint64_t &generation) const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    const CacheEntry &entry = cache_[(size_t)reg];
+    generation = entry.generation;
 
-    std::cerr << ERROR_PREFIX;
-    while (message_stream >> stream_string) {
-        std::cerr << " " << stream_string;
+    if (!entry.valid) {
+        return false;
     }
 
-    if (ctx_) {
-        std::cerr << ": " << modbus_strerror(errno) << std::endl;
+    bool status = reg >= Cached::POSITION;
+    if (status && Utils::monotonicNs() - entry.updated_ns >= max_status_age_ns_) {
+        return false;
+    }
+
+    value = entry.value;
+    return true;
+}
+
+void MotorController::fillCache(Cached reg, int32_t value, uint64_t generation) const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    CacheEntry &entry = cache_[(size_t)reg];
+
+    if (entry.generation == generation) {
+        entry.value = value;
+        entry.updated_ns = Utils::monotonicNs();
+        entry.valid = true;
+    }
+}
+
+void MotorController::writeCache(Cached reg, int32_t value) const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    CacheEntry &entry = cache_[(size_t)reg];
+
+    entry.value = value;
+    entry.updated_ns = Utils::monotonicNs();
+    entry.valid = true;
+    entry.generation++;
+}
+
+void MotorController::dropCache(Cached reg) const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    CacheEntry &entry = cache_[(size_t)reg];
+
+    entry.valid = false;
+    entry.generation++;
+}
+
+// Only the status registers: they age out anyway, while a config value read in the middle
+// of a racing write would stay wrong until invalidated
+MotorController::StatusGenerations MotorController::statusGenerations() const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+
+    return {
+        cache_[(size_t)Cached::POSITION].generation,
+        cache_[(size_t)Cached::VELOCITY].generation,
+        cache_[(size_t)Cached::MOVING].generation
     };
-}
\ No newline at end of file
+}
+
+void MotorController::fillStatusCache(const MotorState &state, const StatusGenerations &generations) const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    uint64_t now = Utils::monotonicNs();
+
+    // Like fillCache, an entry written or dropped since the reads started keeps the newer state
+    auto fill = [&](Cached reg, int32_t value, uint64_t generation) {
+        CacheEntry &entry = cache_[(size_t)reg];
+
+        if (entry.generation == generation) {
+            entry.value = value;
+            entry.updated_ns = now;
+            entry.valid = true;
+        }
+    };
+
+    fill(Cached::POSITION, state.position, generations.position);
+    fill(Cached::VELOCITY, state.velocity, generations.velocity);
+    fill(Cached::MOVING, state.moving, generations.moving);
+}
+
+// Failed libmodbus calls leave the reason in errno
+void MotorController::logError(const std::string &message, int error) const {
+    if (error != 0) {
+        Log::error(message, ": ", modbus_strerror(error));
+    } else {
+        Log::error(message);
+    }
+}
@@ -5,18 +5,46 @@
 #include <modbus/modbus.h>
 #include <unordered_map>
 #include <functional>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "MotorProfile.h"
 
 class MotorController {
+    friend class MotorBus;
+
     public:
-        const std::string INFO_PREFIX = "\x1b[36m[INFO]\x1b[0m";
-        const std::string WARNING_PREFIX = "\x1b[33m[WARNING]\x1b[0m";
-        const std::string ERROR_PREFIX = "\x1b[31;1m[ERROR]\x1b[0m";
+        struct MotorState {
+            int32_t position = 0;
+            int32_t velocity = 0;
+            int32_t initial_velocity = 0;
+            int32_t max_velocity = 0;
+            bool moving = false;
+        };
+
+        struct MoveWaitReport {
+            bool completed = false;
+            uint64_t predicted_ns = 0; // Remaining move time expected when the wait started
+            uint64_t elapsed_ns = 0;
+            int reads = 0; // Modbus requests the wait made
+        };
+
+        using MoveCallback = std::function<void (bool completed)>;
 
         MotorController(const std::string &profile_path, const std::string &ip_address, int port = 502, int slave_id = 1);
         ~MotorController();
 
+        // Once connected the link is supervised: a dropped connection is re-established in the
+        // background and idempotent requests made meanwhile are replayed when it comes back
         bool connect();
+        bool isConnected() const;
 
+        // False when the drive can't be read, waitForMove tells the two apart
         bool isMoving();
 
         int32_t getCurrentPosition() const;
@@ -25,30 +53,151 @@ class MotorController {
         int32_t getInitialVelocity() const;
         int32_t getMaxVelocity() const;
 
+        // Reads every status register in as few requests as the register map allows
+        bool snapshot(MotorState &state) const;
+
+        // Blocks until the last commanded move has finished. The remaining time is predicted from the
+        // distance to the target, the velocity registers and the acceleration learned from earlier
+        // moves; the drive is left alone until shortly before then and polled closely after.
+        // False on timeout or when the drive can't be read
+        bool waitForMove(std::chrono::milliseconds timeout = DEFAULT_MOVE_TIMEOUT, MoveWaitReport *report = nullptr);
+        // Runs callback on a waiter thread once the current move finishes. Callbacks registered
+        // during one wait share it; one registered by a callback waits for the move after
+        void onMoveComplete(MoveCallback callback, std::chrono::milliseconds timeout = DEFAULT_MOVE_TIMEOUT);
+
+        // Ramp acceleration in steps/s^2 learned by waitForMove, 0 before the first whole move
+        uint64_t getLearnedAcceleration() const { return move_acceleration_; }
+        // The profile's [limits] max-velocity
+        int32_t getMaxVelocityLimit() const;
+
+        // Duration of a move with trapezoidal ramps from initial_velocity to max_velocity (steps/s) at
+        // acceleration (steps/s^2), or triangular ones if it is too short to reach max_velocity.
+        // An acceleration of 0 ignores the ramps
+        static double estimateMoveSeconds(double distance, double initial_velocity, double max_velocity, double acceleration);
+
         bool setMicrostepResolution(int8_t microstep_resolution);
         bool setAbsolutePosition(int32_t target_position);
         bool saveSettings();
         bool setInitialVelocity(int32_t inital_velocity);
         bool setMaxVelocity(int32_t max_velocity);
+
+        // Loads the profile file again and swaps it in if it changed and is valid. Calls already
+        // running finish with the profile they started with, later ones use the new one
+        bool reloadProfile();
+        const std::string &getProfilePath() const { return profile_path_; }
+        const std::string &getIpAddress() const { return ip_address_; }
+        int getPort() const { return port_; }
+        int getSlaveId() const { return slave_id_; }
+
+        // Config registers (velocities, microstep resolution) are served from memory once read or
+        // written. Status registers (position, velocity, moving flag) are served from memory while
+        // younger than the max age, which is zero, i.e. always read, by default
+        void setMaxStatusAge(std::chrono::microseconds max_age);
+        // Forget every cached register. Done automatically after saveSettings and a reconnect
+        void invalidateCache();
     
     private:
-        modbus_t *ctx_ = nullptr;
+        enum class Cached {
+            INITIAL_VELOCITY,
+            MAX_VELOCITY,
+            MICROSTEP_RESOLUTION,
+            POSITION,
+            VELOCITY,
+            MOVING,
+            COUNT
+        };
+
+        struct CacheEntry {
+            int32_t value = 0;
+            uint64_t updated_ns = 0;
+            bool valid = false;
+            // Bumped by writes and invalidation so a read that raced one doesn't cache a stale value
+            uint64_t generation = 0;
+        };
+
+        // Generations of the status entries a snapshot fills, taken before its reads
+        struct StatusGenerations {
+            uint64_t position;
+            uint64_t velocity;
+            uint64_t moving;
+        };
+
+        static constexpr std::chrono::milliseconds DEFAULT_MOVE_TIMEOUT{60000};
+        // Polling starts this long, plus twice the typical prediction error, before the predicted end
+        static constexpr std::chrono::milliseconds MOVE_WAKE_LEAD{5};
+        static constexpr std::chrono::milliseconds MOVE_POLL_INTERVAL{2};
+        // A move that hasn't raised the moving flag by then is taken to have ended, or never started
+        static constexpr std::chrono::milliseconds MOVE_START_GRACE{50};
+
+        static constexpr std::chrono::milliseconds RECONNECT_BACKOFF_MIN{50};
+        static constexpr std::chrono::milliseconds RECONNECT_BACKOFF_MAX{400};
+        // How long an idempotent request waits for the link to come back before failing
+        static constexpr std::chrono::milliseconds REPLAY_TIMEOUT{1000};
+
+        mutable modbus_t *ctx_ = nullptr;
+        mutable std::mutex ctx_mutex_;
+        mutable std::condition_variable link_cv_;
+        std::thread supervisor_;
+        bool supervised_ = false;
+        bool stopping_ = false;
+
+        std::atomic<bool> has_target_{false};
+        std::atomic<int32_t> last_target_{0};
+
+        // Learned from completed moves, the register map has no acceleration. 0 until the first one
+        std::atomic<uint64_t> move_acceleration_{0};
+        std::atomic<uint64_t> move_eta_error_ns_{0};
+
+        // One waiter thread serves every onMoveComplete, so callbacks can register the next one
+        std::mutex move_waiter_mutex_;
+        std::condition_variable move_waiter_cv_;
+        std::thread move_waiter_;
+        std::vector<MoveCallback> move_callbacks_;
+        std::chrono::milliseconds move_callback_timeout_{DEFAULT_MOVE_TIMEOUT};
+        // Set by the destructor, cuts short waits in progress
+        bool move_stopping_ = false;
+
         std::string ip_address_;
         int port_;
         int slave_id_;
 
-        int READ_AXIS_VELOCITY_START;
+        std::string profile_path_;
 
-        int MICROSTEP_RESOLUTION_ADDRESS;
-        int MOVING_FLAG_ADDRESS;
-        int ABS_POSITION_REGISTER_START;
-        int SAVE_SETTINGS_REGISTER;
-        int INITIAL_VELOCITY_REGISTER_START;
-        int MAX_VELOCITY_REGISTER_START;
+        // Never null: an unloaded placeholder until a profile loads, requests are refused meanwhile.
+        // Replaced whole by reloadProfile, so it is only accessed with std::atomic_load/atomic_store;
+        // a call loads it once and uses that version throughout
+        std::shared_ptr<const MotorProfile> profile_;
 
-        int MAX_VELOCITY;
+        mutable std::mutex cache_mutex_;
+        mutable CacheEntry cache_[(size_t)Cached::COUNT];
+        std::atomic<uint64_t> max_status_age_ns_{0};
 
         bool loadProfile(const std::string &profile_path);
+        std::shared_ptr<const MotorProfile> currentProfile() const { return std::atomic_load(&profile_); }
+
+        // For public calls that need several registers, all from the profile they loaded
+        bool snapshot(const MotorProfile &profile, MotorState &state) const;
+        int32_t getInitialVelocity(const MotorProfile &profile) const;
+        int32_t getMaxVelocity(const MotorProfile &profile) const;
+        void runMoveWaiter();
+        // False if the motor is being destroyed
+        bool sleepForMove(uint64_t deadline_ns);
+        void decodeSnapshotSpan(const MotorProfile &profile, const MotorProfile::RegisterSpan &span, const uint16_t *data, MotorState &state) const;
+
+        // On a miss, generation is what fillCache needs to store the value read from the drive
+        bool readCache(Cached reg, int32_t &value, uint64_t &generation) const;
+        void fillCache(Cached reg, int32_t value, uint64_t generation) const;
+        void writeCache(Cached reg, int32_t value) const;
+        void dropCache(Cached reg) const;
+        StatusGenerations statusGenerations() const;
+        void fillStatusCache(const MotorState &state, const StatusGenerations &generations) const;
+
+        modbus_t *openContext(bool log_failure) const;
+        void supervise();
+        void dropLink() const;
+        void reportLinkFailure(int socket) const;
+
+        bool request(const std::string &error_message, bool idempotent, const std::function<int (modbus_t *ctx)> &call) const;
 
         bool readFlag(int address, bool &value) const;
         bool read8BitRegister(int address, int8_t &value) const;
@@ -57,6 +206,6 @@ class MotorController {
         bool write8BitRegister(int address, int8_t value);
         bool write32BitRegister(int address, int32_t value);
 
-        void logError(const std::string &message) const;
-        void logError(std::stringstream &message_stream) const;
+        // error is the errno saved when the call failed, 0 logs the message alone
+        void logError(const std::string &message, int error = 0) const;
 };
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "MotorMailbox.h"
+
+#include <utility>
+
+#include "MotorController.h"
+
+MotorMailbox::MotorMailbox(MotorController &motor) : _motor(motor) {
+    _thread = std::thread(&MotorMailbox::loop, this);
+}
+
+MotorMailbox::~MotorMailbox() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cv.notify_one();
+
+    _thread.join();
+}
+
+bool MotorMailbox::Setpoints::empty() const {
+    for (bool is_pending : pending) {
+        if (is_pending) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void MotorMailbox::setAbsolutePosition(int32_t target_position) {
+    post(Setpoint::POSITION, target_position);
+}
+
+void MotorMailbox::setInitialVelocity(int32_t initial_velocity) {
+    post(Setpoint::INITIAL_VELOCITY, initial_velocity);
+}
+
+void MotorMailbox::setMaxVelocity(int32_t max_velocity) {
+    post(Setpoint::MAX_VELOCITY, max_velocity);
+}
+
+void MotorMailbox::setMicrostepResolution(int8_t microstep_resolution, Callback callback) {
+    post([this, microstep_resolution] { return _motor.setMicrostepResolution(microstep_resolution); }, std::move(callback));
+}
+
+void MotorMailbox::saveSettings(Callback callback) {
+    post([this] { return _motor.saveSettings(); }, std::move(callback));
+}
+
+void MotorMailbox::post(Setpoint setpoint, int32_t value) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        size_t index = (size_t)setpoint;
+
+        if (_setpoints.pending[index]) {
+            _stats.superseded++;
+        }
+
+        _setpoints.values[index] = value;
+        _setpoints.pending[index] = true;
+    }
+    _cv.notify_one();
+}
+
+void MotorMailbox::post(std::function<bool ()> command, Callback callback) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // Setpoints posted so far go out ahead of the command, later ones after it
+        _ordered.push_back({_setpoints, std::move(command), std::move(callback)});
+        _setpoints = Setpoints();
+    }
+    _cv.notify_one();
+}
+
+void MotorMailbox::flush() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle_cv.wait(lock, [this] { return !_busy && _ordered.empty() && _setpoints.empty(); });
+}
+
+MotorMailbox::Stats MotorMailbox::stats() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+void MotorMailbox::send(const Setpoints &setpoints) {
+    Setpoint order[] = {Setpoint::INITIAL_VELOCITY, Setpoint::MAX_VELOCITY, Setpoint::POSITION};
+
+    // The drive keeps the initial velocity below the max, so raising both has to move the max
+    // out of the way first and lowering both the initial velocity
+    size_t initial_index = (size_t)Setpoint::INITIAL_VELOCITY;
+    if (setpoints.pending[initial_index] && setpoints.pending[(size_t)Setpoint::MAX_VELOCITY] &&
+        setpoints.values[initial_index] > _motor.getInitialVelocity()) {
+        std::swap(order[0], order[1]);
+    }
+
+    for (Setpoint setpoint : order) {
+        size_t index = (size_t)setpoint;
+        if (!setpoints.pending[index]) {
+            continue;
+        }
+
+        int32_t value = setpoints.values[index];
+        bool sent = false;
+
+        switch (setpoint) {
+            case Setpoint::INITIAL_VELOCITY:
+                sent = _motor.setInitialVelocity(value);
+                break;
+            case Setpoint::MAX_VELOCITY:
+                sent = _motor.setMaxVelocity(value);
+                break;
+            case Setpoint::POSITION:
+                sent = _motor.setAbsolutePosition(value);
+                break;
+            case Setpoint::COUNT:
+                break;
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.sent++;
+        _stats.failed += !sent;
+    }
+}
+
+void MotorMailbox::loop() {
+    while (true) {
+        Ordered next;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _busy = false;
+            _idle_cv.notify_all();
+
+            _cv.wait(lock, [this] { return _stopping || !_ordered.empty() || !_setpoints.empty(); });
+
+            if (!_ordered.empty()) {
+                next = std::move(_ordered.front());
+                _ordered.pop_front();
+            } else if (!_setpoints.empty()) {
+                next.before = _setpoints;
+                _setpoints = Setpoints();
+            } else {
+                return;
+            }
+
+            _busy = true;
+        }
+
+        send(next.before);
+
+        if (next.command) {
+            bool ok = next.command();
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stats.sent++;
+                _stats.failed += !ok;
+            }
+
+            if (next.callback) {
+                next.callback(ok);
+            }
+        }
+    }
+}
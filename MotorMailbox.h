@@ -0,0 +1,88 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+class MotorController;
+
+// Sends commands to one drive from its own thread so callers never wait on a round trip.
+// Setpoints (target position and velocities) are latest-wins: one that is replaced before
+// the thread gets to it is dropped, so however fast they arrive, a new one waits for at most
+// the command in flight. Ordered commands (microstep resolution, saveSettings) always run,
+// in the order posted and after every setpoint posted before them.
+class MotorMailbox {
+    public:
+        using Callback = std::function<void (bool ok)>;
+
+        struct Stats {
+            uint64_t sent = 0;
+            uint64_t superseded = 0; // Setpoints dropped for a newer one
+            uint64_t failed = 0;
+        };
+
+        explicit MotorMailbox(MotorController &motor);
+        // Sends whatever is still queued first
+        ~MotorMailbox();
+
+        MotorMailbox(const MotorMailbox&) = delete;
+        MotorMailbox& operator=(const MotorMailbox&) = delete;
+
+        // Setpoints pending together go out velocities first, so the move runs at the newest ones.
+        // Velocities are written in whichever order keeps the initial one below the max
+        void setAbsolutePosition(int32_t target_position);
+        void setInitialVelocity(int32_t initial_velocity);
+        void setMaxVelocity(int32_t max_velocity);
+
+        // callback runs on the command thread with the result
+        void setMicrostepResolution(int8_t microstep_resolution, Callback callback = nullptr);
+        void saveSettings(Callback callback = nullptr);
+
+        // Blocks until everything posted so far has been sent
+        void flush();
+
+        Stats stats() const;
+
+    private:
+        // In the order a batch is sent, unless the velocities are being raised
+        enum class Setpoint {
+            INITIAL_VELOCITY,
+            MAX_VELOCITY,
+            POSITION,
+            COUNT
+        };
+
+        struct Setpoints {
+            int32_t values[(size_t)Setpoint::COUNT] = {};
+            bool pending[(size_t)Setpoint::COUNT] = {};
+
+            bool empty() const;
+        };
+
+        struct Ordered {
+            Setpoints before; // Posted ahead of the command, no longer replaceable
+            std::function<bool ()> command;
+            Callback callback;
+        };
+
+        MotorController &_motor;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _cv;
+        std::condition_variable _idle_cv;
+        Setpoints _setpoints;
+        std::deque<Ordered> _ordered;
+        bool _busy = false;
+        bool _stopping = false;
+        Stats _stats;
+
+        std::thread _thread;
+
+        void post(Setpoint setpoint, int32_t value);
+        void post(std::function<bool ()> command, Callback callback);
+        void send(const Setpoints &setpoints);
+        void loop();
+};
@@ -0,0 +1,310 @@
+#include "MotorProfile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <modbus/modbus.h>
+
+struct ProfileField {
+    std::string_view table;
+    std::string_view key;
+    int32_t MotorProfile::*member;
+    int base;
+    int width; // Registers occupied, 0 for plain values
+};
+
+static const ProfileField FIELDS[] = {
+    {"registers", "read-axis-velocity", &MotorProfile::read_axis_velocity, 16, 2},
+    {"registers", "microstep-resolution", &MotorProfile::microstep_resolution, 16, 1},
+    {"registers", "moving-flag", &MotorProfile::moving_flag, 16, 1},
+    {"registers", "position", &MotorProfile::position, 16, 2},
+    {"registers", "save-settings", &MotorProfile::save_settings, 16, 1},
+    {"registers", "initial-velocity", &MotorProfile::initial_velocity, 16, 2},
+    {"registers", "max-velocity", &MotorProfile::max_velocity, 16, 2},
+    {"limits", "max-velocity", &MotorProfile::max_velocity_limit, 10, 0},
+};
+
+static constexpr size_t FIELD_COUNT = sizeof(FIELDS) / sizeof(FIELDS[0]);
+
+static const char COMPILED_MAGIC[8] = {'M', 'C', 'P', 'R', 'O', 'F', 'I', 'L'};
+static const uint32_t COMPILED_VERSION = 1;
+
+struct CompiledProfile {
+    char magic[8];
+    uint32_t version;
+    uint32_t field_count;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    int32_t fields[FIELD_COUNT];
+};
+
+static std::string_view trim(std::string_view text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string_view::npos) {
+        return std::string_view();
+    }
+
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool MotorProfile::parse(const char *data, size_t size, MotorProfile &profile, std::string &error, std::string &warnings) {
+    std::string_view text(data, size);
+    std::string_view table;
+    size_t line_number = 0;
+
+    for (size_t pos = 0; pos < text.size();) {
+        size_t end = std::min(text.find('\n', pos), text.size());
+        std::string_view line = text.substr(pos, end - pos);
+        pos = end + 1;
+        line_number++;
+
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) {
+            continue;
+        }
+
+        if (line.front() == '[') {
+            if (line.back() != ']') {
+                error = "Line " + std::to_string(line_number) + ": unterminated table header";
+                return false;
+            }
+
+            table = trim(line.substr(1, line.size() - 2));
+            continue;
+        }
+
+        size_t equals = line.find('=');
+        if (equals == std::string_view::npos) {
+            error = "Line " + std::to_string(line_number) + ": expected key = value";
+            return false;
+        }
+
+        std::string_view key = trim(line.substr(0, equals));
+        std::string_view value = trim(line.substr(equals + 1));
+
+        const ProfileField *field = nullptr;
+        bool known_table = false;
+        for (const ProfileField &candidate : FIELDS) {
+            known_table = known_table || table == candidate.table;
+
+            if (table == candidate.table && key == candidate.key) {
+                field = &candidate;
+                break;
+            }
+        }
+
+        if (!field) {
+            if (known_table) {
+                warnings += "Unknown configuration key: " + std::string(key) + "\n";
+            }
+            continue;
+        }
+
+        if (field->base == 16 && value.size() > 2 && value[0] == '0' && (value[1] == 'x' || value[1] == 'X')) {
+            value.remove_prefix(2);
+        }
+
+        int32_t parsed = 0;
+        auto result = std::from_chars(value.data(), value.data() + value.size(), parsed, field->base);
+
+        if (value.empty() || result.ec != std::errc() || result.ptr != value.data() + value.size()) {
+            error = "Line " + std::to_string(line_number) + ": invalid value for " + std::string(key);
+            return false;
+        }
+
+        profile.*(field->member) = parsed;
+    }
+
+    return true;
+}
+
+bool MotorProfile::validate(std::string &error) const {
+    // Only built for the error, valid profiles don't allocate
+    auto name = [](const ProfileField &field) {
+        std::string name = "[";
+        name.append(field.table).append("] ").append(field.key);
+        return name;
+    };
+
+    for (const ProfileField &field : FIELDS) {
+        int32_t value = this->*(field.member);
+
+        if (value < 0) {
+            error = "Missing or negative " + name(field);
+            return false;
+        } else if (field.width > 0 && value + field.width - 1 > 0xFFFF) {
+            error = name(field) + " is outside the 16-bit register space";
+            return false;
+        }
+    }
+
+    if (max_velocity_limit == 0) {
+        error = "[limits] max-velocity must be above 0";
+        return false;
+    }
+
+    return true;
+}
+
+void MotorProfile::planSnapshotSpans() {
+    std::vector<RegisterSpan> fields = {
+        {position, 2},
+        {read_axis_velocity, 2},
+        {initial_velocity, 2},
+        {max_velocity, 2},
+        {moving_flag, 1}
+    };
+
+    std::sort(fields.begin(), fields.end(), [](const RegisterSpan &a, const RegisterSpan &b) {
+        return a.start < b.start;
+    });
+
+    snapshot_spans.clear();
+    for (const RegisterSpan &field : fields) {
+        if (!snapshot_spans.empty()) {
+            RegisterSpan &span = snapshot_spans.back();
+            int span_end = span.start + span.count;
+            int field_end = std::max(span_end, field.start + field.count);
+
+            if (field.start <= span_end + SNAPSHOT_MAX_GAP && field_end - span.start <= MODBUS_MAX_READ_REGISTERS) {
+                span.count = field_end - span.start;
+                continue;
+            }
+        }
+
+        snapshot_spans.push_back(field);
+    }
+}
+
+bool MotorProfile::readCompiled(const std::string &path) {
+    CompiledProfile compiled;
+
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    size_t read = fread(&compiled, sizeof(compiled), 1, file);
+    fclose(file);
+
+    if (read != 1 || memcmp(compiled.magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC)) != 0 ||
+        compiled.version != COMPILED_VERSION || compiled.field_count != FIELD_COUNT) {
+        return false;
+    }
+
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        this->*(FIELDS[i].member) = compiled.fields[i];
+    }
+
+    source_size = compiled.source_size;
+    source_mtime_ns = compiled.source_mtime_ns;
+    return true;
+}
+
+bool MotorProfile::writeCompiled(const std::string &path) const {
+    CompiledProfile compiled = {};
+    memcpy(compiled.magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC));
+    compiled.version = COMPILED_VERSION;
+    compiled.field_count = FIELD_COUNT;
+    compiled.source_size = source_size;
+    compiled.source_mtime_ns = source_mtime_ns;
+
+    for (size_t i = 0; i < FIELD_COUNT; i++) {
+        compiled.fields[i] = this->*(FIELDS[i].member);
+    }
+
+    // Written aside and renamed so a concurrent reader never sees half a file
+    std::string temporary = path + "." + std::to_string(getpid());
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    bool written = fwrite(&compiled, sizeof(compiled), 1, file) == 1;
+    written = fclose(file) == 0 && written;
+
+    if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+std::shared_ptr<const MotorProfile> MotorProfile::load(const std::string &path, std::string &error, std::string &warnings) {
+    static std::mutex cache_mutex;
+    static std::unordered_map<std::string, std::shared_ptr<const MotorProfile>> cache;
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+
+    if (fd == -1 || fstat(fd, &info) == -1) {
+        error = "Couldn't open the profile file " + path;
+        if (fd != -1) {
+            close(fd);
+        }
+        return nullptr;
+    }
+
+    uint64_t size = info.st_size;
+    int64_t mtime_ns = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+
+    auto cached = cache.find(path);
+    if (cached != cache.end() && cached->second->source_size == size && cached->second->source_mtime_ns == mtime_ns) {
+        close(fd);
+        return cached->second;
+    }
+
+    auto profile = std::make_shared<MotorProfile>();
+    std::string compiled_path = path + ".bin";
+
+    bool compiled = profile->readCompiled(compiled_path) && profile->source_size == size &&
+                    profile->source_mtime_ns == mtime_ns && profile->validate(error);
+
+    if (!compiled) {
+        *profile = MotorProfile();
+        error.clear();
+
+        void *data = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+        if (data == MAP_FAILED) {
+            error = "Couldn't map the profile file " + path;
+            close(fd);
+            return nullptr;
+        }
+
+        bool parsed = parse(static_cast<const char *>(data), size, *profile, error, warnings);
+
+        if (data) {
+            munmap(data, size);
+        }
+
+        if (!parsed || !profile->validate(error)) {
+            close(fd);
+            return nullptr;
+        }
+
+        profile->source_size = size;
+        profile->source_mtime_ns = mtime_ns;
+        profile->writeCompiled(compiled_path);
+    }
+
+    close(fd);
+
+    profile->planSnapshotSpans();
+    profile->loaded = true;
+
+    cache[path] = profile;
+    return profile;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Register map and limits of a drive, loaded from a TOML profile such as LMD_P42.toml.
+//
+// Profiles are parsed in one pass over the memory-mapped file with no per-key
+// allocation, and every register is validated. Loaded profiles are immutable and
+// shared: every MotorController using the same file gets the same instance, and a
+// compiled copy is written next to the source (<profile>.bin) so later processes
+// skip the parse until the source changes.
+struct MotorProfile {
+    struct RegisterSpan {
+        int start;
+        int count;
+    };
+
+    // Registers this close together are read in one request instead of two
+    static constexpr int SNAPSHOT_MAX_GAP = 32;
+
+    // [registers]
+    int32_t read_axis_velocity = -1;
+    int32_t microstep_resolution = -1;
+    int32_t moving_flag = -1;
+    int32_t position = -1;
+    int32_t save_settings = -1;
+    int32_t initial_velocity = -1;
+    int32_t max_velocity = -1;
+
+    // [limits]
+    int32_t max_velocity_limit = -1;
+
+    // Fewest contiguous reads covering every status register, see MotorController::snapshot
+    std::vector<RegisterSpan> snapshot_spans;
+
+    bool loaded = false;
+
+    // Identifies the source file version the profile was built from
+    uint64_t source_size = 0;
+    int64_t source_mtime_ns = 0;
+
+    // Returns nullptr and sets error if the profile can't be read or is invalid
+    static std::shared_ptr<const MotorProfile> load(const std::string &path, std::string &error, std::string &warnings);
+
+    // Parses TOML text, unknown keys are reported through warnings and skipped
+    static bool parse(const char *data, size_t size, MotorProfile &profile, std::string &error, std::string &warnings);
+    bool validate(std::string &error) const;
+    void planSnapshotSpans();
+
+    bool readCompiled(const std::string &path);
+    bool writeCompiled(const std::string &path) const;
+};
@@ -0,0 +1,133 @@
+#include "MovePlanner.h"
+#include "MotorController.h"
+#include "Log.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+MovePlanner::MovePlanner(MotorController &motor, uint32_t acceleration)
+    : _motor(motor),
+      _acceleration(acceleration)
+{}
+
+bool MovePlanner::plan(const std::vector<Move> &moves, Plan &plan) const {
+    MotorController::MotorState state;
+
+    if (!_motor.snapshot(state)) {
+        Log::error("Couldn't read the drive to plan moves");
+        return false;
+    }
+
+    int32_t limit = _motor.getMaxVelocityLimit();
+    if (limit <= state.initial_velocity) {
+        Log::error("Velocity limit ", limit, " leaves no room above the initial velocity ", state.initial_velocity);
+        return false;
+    }
+
+    plan = Plan();
+
+    double acceleration = _motor.getLearnedAcceleration();
+    if (acceleration == 0) {
+        acceleration = _acceleration;
+        plan.verified = false;
+    }
+
+    int32_t position = state.position;
+    int32_t max_velocity = state.max_velocity;
+    const int32_t initial_velocity = state.initial_velocity;
+
+    auto seconds = [&](double distance, int32_t velocity) {
+        return MotorController::estimateMoveSeconds(distance, std::max(initial_velocity, 1), velocity, acceleration);
+    };
+
+    for (const Move &move : moves) {
+        PlannedMove planned;
+        planned.position = move.position;
+        planned.initial_velocity = initial_velocity;
+
+        double distance = std::abs((int64_t)move.position - position);
+        double deadline = std::chrono::duration<double>(move.deadline).count();
+        double target = deadline * (1 - DEADLINE_MARGIN);
+        int32_t velocity = limit;
+
+        if (distance == 0 && max_velocity > initial_velocity) {
+            velocity = max_velocity;
+        } else if (move.deadline.count() > 0 && plan.verified && seconds(distance, limit) <= target) {
+            // Only a learned acceleration is trusted to slow a move down. Time shrinks as the
+            // max velocity grows, so the slowest one in time is found by bisection
+            int32_t low = initial_velocity + 1;
+            int32_t high = limit;
+
+            while (low < high) {
+                int32_t middle = low + (high - low) / 2;
+
+                if (seconds(distance, middle) <= target) {
+                    high = middle;
+                } else {
+                    low = middle + 1;
+                }
+            }
+
+            velocity = high;
+        } else if (move.deadline.count() > 0 && seconds(distance, limit) > deadline) {
+            planned.meets_deadline = false;
+            plan.feasible = false;
+        }
+
+        // Short moves may never reach the chosen velocity; the one on the drive does as well then.
+        // Like the bisection, that's only trusted with a learned acceleration
+        if (plan.verified && max_velocity > initial_velocity && velocity != max_velocity &&
+            seconds(distance, max_velocity) <= seconds(distance, velocity) &&
+            (move.deadline.count() == 0 || max_velocity <= velocity)) {
+            velocity = max_velocity;
+        }
+
+        if (velocity != max_velocity) {
+            plan.register_writes++;
+            max_velocity = velocity;
+        }
+
+        planned.max_velocity = velocity;
+        planned.seconds = seconds(distance, velocity);
+
+        plan.seconds += planned.seconds;
+        plan.moves.push_back(planned);
+        position = move.position;
+    }
+
+    return true;
+}
+
+bool MovePlanner::run(const Plan &plan) {
+    for (const PlannedMove &move : plan.moves) {
+        // Served from the register cache, so unchanged settings cost no requests
+        if (_motor.getMaxVelocity() != move.max_velocity && !_motor.setMaxVelocity(move.max_velocity)) {
+            return false;
+        }
+
+        if (!_motor.setAbsolutePosition(move.position)) {
+            return false;
+        }
+
+        if (!_motor.waitForMove()) {
+            Log::error("Planned move to ", move.position, " did not complete");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool MovePlanner::execute(const std::vector<Move> &moves, Plan *plan) {
+    Plan planned;
+
+    if (!this->plan(moves, planned)) {
+        return false;
+    }
+
+    if (plan) {
+        *plan = planned;
+    }
+
+    return run(planned);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+class MotorController;
+
+// Plans a sequence of absolute moves for one LMD drive. Moves without a deadline run at the
+// profile's velocity limit; moves with one get the lowest max velocity that still arrives in
+// time with DEADLINE_MARGIN to spare, so they land on cue rather than early. Velocity
+// registers are only written when a move needs a different value from the one on the drive.
+//
+// Ramps are estimated with the acceleration the motor learned from earlier moves, or the
+// hint given until it has one. Only a learned acceleration slows deadline moves down: a
+// wrong hint would make them late, so until then they run as fast as possible and the hint
+// only feeds the estimates. With neither, estimates ignore the ramps and are a lower bound.
+class MovePlanner {
+    public:
+        struct Move {
+            int32_t position;
+            // Time allowed from commanding the move to arriving, zero for as fast as possible
+            std::chrono::milliseconds deadline{0};
+        };
+
+        struct PlannedMove {
+            int32_t position = 0;
+            int32_t initial_velocity = 0;
+            int32_t max_velocity = 0;
+            double seconds = 0; // Estimated
+            // With no acceleration known, only that the deadline isn't ruled out
+            bool meets_deadline = true;
+        };
+
+        struct Plan {
+            std::vector<PlannedMove> moves;
+            double seconds = 0; // Estimated duration of the whole sequence
+            bool feasible = true; // Every deadline can be met
+            int register_writes = 0; // Velocity writes the sequence needs
+            // Estimates use the acceleration learned from the drive rather than the hint or none
+            bool verified = true;
+        };
+
+        // Fraction of each deadline kept in hand for estimate error
+        static constexpr double DEADLINE_MARGIN = 0.05;
+
+        // acceleration (steps/s^2) stands in for estimates until the motor has learned its own from a whole move
+        explicit MovePlanner(MotorController &motor, uint32_t acceleration = 0);
+
+        // Dry run: reads the position and velocity settings, moves nothing
+        bool plan(const std::vector<Move> &moves, Plan &plan) const;
+        // Runs the moves in order, waiting for each. False at the first one that fails
+        bool run(const Plan &plan);
+        // Plans against the drive as it is now and runs the result
+        bool execute(const std::vector<Move> &moves, Plan *plan = nullptr);
+
+    private:
+        MotorController &_motor;
+        uint32_t _acceleration;
+};
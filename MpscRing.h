@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue for many producers and one consumer. Each slot carries a
+// sequence number telling whose turn it is, so producers only contend on claiming a
+// position and never wait on each other or on the consumer: a full ring refuses the push.
+template <typename T, size_t Capacity>
+class MpscRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+        MpscRing() {
+            for (size_t i = 0; i < Capacity; i++) {
+                _slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpscRing(const MpscRing &) = delete;
+        MpscRing &operator=(const MpscRing &) = delete;
+
+        // fill(T &) writes the element in place; returns false when the ring is full
+        template <typename Fill>
+        bool tryPush(Fill &&fill) {
+            size_t position = _head.load(std::memory_order_relaxed);
+            Slot *slot;
+
+            while (true) {
+                slot = &_slots[position & (Capacity - 1)];
+                size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+                if (difference == 0) {
+                    if (_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = _head.load(std::memory_order_relaxed);
+                }
+            }
+
+            fill(slot->value);
+            slot->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer only. visit(T &) reads the element in place; returns false when empty
+        template <typename Visit>
+        bool tryPop(Visit &&visit) {
+            size_t position = _tail.load(std::memory_order_relaxed);
+            Slot &slot = _slots[position & (Capacity - 1)];
+
+            if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+                return false;
+            }
+
+            visit(slot.value);
+            slot.sequence.store(position + Capacity, std::memory_order_release);
+            _tail.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Running totals of claimed and consumed positions
+        size_t pushed() const { return _head.load(std::memory_order_acquire); }
+        size_t popped() const { return _tail.load(std::memory_order_acquire); }
+
+    private:
+        struct Slot {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        Slot _slots[Capacity];
+
+        alignas(64) std::atomic<size_t> _head{0};
+        alignas(64) std::atomic<size_t> _tail{0};
+};
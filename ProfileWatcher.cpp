@@ -0,0 +1,177 @@
+#include "ProfileWatcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "Log.h"
+#include "MotorController.h"
+
+static constexpr uint32_t WATCH_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+ProfileWatcher::~ProfileWatcher() {
+    stop();
+    close();
+}
+
+void ProfileWatcher::close() {
+    if (_inotify_fd != -1) {
+        ::close(_inotify_fd);
+        _inotify_fd = -1;
+    }
+
+    if (_stop_fd != -1) {
+        ::close(_stop_fd);
+        _stop_fd = -1;
+    }
+
+    _watches.clear();
+}
+
+bool ProfileWatcher::add(MotorController &motor) {
+    if (_thread.joinable()) {
+        Log::error("Profiles must be added before the watcher starts");
+        return false;
+    }
+
+    if (_inotify_fd == -1) {
+        _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        _stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (_inotify_fd == -1 || _stop_fd == -1) {
+            Log::error("Couldn't set up profile watching: ", strerror(errno));
+            close();
+            return false;
+        }
+    }
+
+    const std::string &path = motor.getProfilePath();
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    // Watching a directory twice gives back the same descriptor
+    int descriptor = inotify_add_watch(_inotify_fd, directory.c_str(), WATCH_EVENTS);
+    if (descriptor == -1) {
+        Log::error("Couldn't watch ", directory, " for profile changes: ", strerror(errno));
+        return false;
+    }
+
+    for (Watch &watch : _watches) {
+        if (watch.descriptor == descriptor && watch.name == name) {
+            watch.motors.push_back(&motor);
+            return true;
+        }
+    }
+
+    _watches.push_back({descriptor, name, {&motor}});
+    return true;
+}
+
+bool ProfileWatcher::start() {
+    if (_inotify_fd == -1) {
+        Log::error("No profiles to watch");
+        return false;
+    } else if (_thread.joinable()) {
+        Log::error("Profile watcher is already running");
+        return false;
+    }
+
+    uint64_t count;
+    while (read(_stop_fd, &count, sizeof(count)) > 0) {}
+
+    _thread = std::thread(&ProfileWatcher::loop, this);
+    return true;
+}
+
+void ProfileWatcher::stop() {
+    if (!_thread.joinable()) {
+        return;
+    }
+
+    uint64_t one = 1;
+    if (write(_stop_fd, &one, sizeof(one)) != sizeof(one)) {
+        Log::error("Couldn't stop the profile watcher: ", strerror(errno));
+    }
+
+    _thread.join();
+}
+
+// Marks the watches whose files changed. False if nothing was there to read
+bool ProfileWatcher::readEvents() {
+    alignas(inotify_event) char buffer[4096];
+    bool any = false;
+
+    while (true) {
+        ssize_t length = read(_inotify_fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            return any;
+        }
+
+        any = true;
+
+        for (ssize_t offset = 0; offset < length;) {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // Events were lost, so any of the files may have changed
+                for (Watch &watch : _watches) {
+                    watch.changed = true;
+                }
+                continue;
+            }
+
+            for (Watch &watch : _watches) {
+                if (watch.descriptor == event->wd && event->len > 0 && watch.name == event->name) {
+                    watch.changed = true;
+                }
+            }
+        }
+    }
+}
+
+void ProfileWatcher::loop() {
+    pollfd fds[2] = {{_inotify_fd, POLLIN, 0}, {_stop_fd, POLLIN, 0}};
+    int timeout_ms = -1;
+
+    while (true) {
+        if (poll(fds, 2, timeout_ms) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            Log::error("Profile watcher failed: ", strerror(errno));
+            return;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            return;
+        }
+
+        // Wait for the file to settle before reloading what changed
+        if (readEvents()) {
+            timeout_ms = RELOAD_SETTLE.count();
+            continue;
+        }
+
+        timeout_ms = -1;
+
+        for (Watch &watch : _watches) {
+            if (!watch.changed) {
+                continue;
+            }
+
+            watch.changed = false;
+
+            // Motors sharing the file share the parse, the profile is cached per file version
+            for (MotorController *motor : watch.motors) {
+                motor->reloadProfile();
+            }
+        }
+    }
+}
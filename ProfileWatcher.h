@@ -0,0 +1,48 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+class MotorController;
+
+// Reloads the profiles of MotorControllers when their files change, without stopping them.
+// Files are watched with inotify through their directory, so editors that save by renaming a
+// new file over the old one are seen too. The new profile is parsed and validated on the
+// watcher thread and swapped in by MotorController::reloadProfile; a bad edit is logged and
+// the motors keep the profile they have.
+class ProfileWatcher {
+    public:
+        ProfileWatcher() = default;
+        ~ProfileWatcher();
+
+        ProfileWatcher(const ProfileWatcher&) = delete;
+        ProfileWatcher& operator=(const ProfileWatcher&) = delete;
+
+        // Before start(). The motor must outlive the watcher
+        bool add(MotorController &motor);
+
+        bool start();
+        void stop();
+
+    private:
+        // Changes closer together than this, like an editor's write and rename, reload once
+        static constexpr std::chrono::milliseconds RELOAD_SETTLE{50};
+
+        struct Watch {
+            int descriptor;
+            std::string name; // File name within the watched directory
+            std::vector<MotorController *> motors;
+            bool changed = false;
+        };
+
+        int _inotify_fd = -1;
+        int _stop_fd = -1;
+        std::vector<Watch> _watches;
+        std::thread _thread;
+
+        bool readEvents();
+        void loop();
+        void close();
+};
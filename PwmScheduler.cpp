@@ -0,0 +1,277 @@
+#include "PwmScheduler.h"
+#include "Utils.h"
+#include "Metrics.h"
+#include "Log.h"
+#include "RealTime.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+    std::mutex schedulers_mutex;
+    std::map<std::pair<GpioBackend *, std::string>, std::unique_ptr<PwmScheduler>> schedulers;
+}
+
+PwmScheduler *PwmScheduler::acquire(const std::string &chip_path, unsigned int pin, GpioBackend &backend) {
+    std::lock_guard<std::mutex> lock(schedulers_mutex);
+
+    auto entry = schedulers.find({&backend, chip_path});
+    if (entry == schedulers.end()) {
+        entry = schedulers.emplace(std::make_pair(&backend, chip_path),
+                                   std::make_unique<PwmScheduler>(chip_path, 20000, backend)).first;
+    }
+
+    PwmScheduler *scheduler = entry->second.get();
+    if (!scheduler->addChannel(pin)) {
+        if (scheduler->empty()) {
+            schedulers.erase(entry);
+        }
+        return nullptr;
+    }
+
+    return scheduler;
+}
+
+// Dropping the entry with its last channel means a backend created later at the same address
+// never inherits a scheduler bound to the old one
+void PwmScheduler::release(PwmScheduler *scheduler, unsigned int pin) {
+    std::lock_guard<std::mutex> lock(schedulers_mutex);
+
+    scheduler->removeChannel(pin);
+    if (!scheduler->empty()) {
+        return;
+    }
+
+    auto entry = schedulers.find({&scheduler->_backend, scheduler->_chip_path});
+    if (entry != schedulers.end() && entry->second.get() == scheduler) {
+        schedulers.erase(entry);
+    }
+}
+
+PwmScheduler::PwmScheduler(const std::string &chip_path, int period_us, GpioBackend &backend)
+    : _backend(backend),
+      _chip_path(chip_path),
+      _period_ns(period_us * 1000ull),
+      _running(false)
+{}
+
+PwmScheduler::~PwmScheduler() {
+    std::lock_guard<std::mutex> lifecycle(_lifecycle_mutex);
+    stopThread();
+}
+
+bool PwmScheduler::addChannel(unsigned int pin) {
+    std::lock_guard<std::mutex> lifecycle(_lifecycle_mutex);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_channels.count(pin)) {
+            return true;
+        }
+
+        _channels[pin] = Channel();
+        if (!rebuildRequest()) {
+            _channels.erase(pin);
+            rebuildRequest();
+            return false;
+        }
+    }
+
+    if (!_running) {
+        if (_thread.joinable()) {
+            _thread.join();
+        }
+
+        _running = true;
+        _thread = std::thread(&PwmScheduler::loop, this);
+    }
+
+    return true;
+}
+
+void PwmScheduler::removeChannel(unsigned int pin) {
+    std::lock_guard<std::mutex> lifecycle(_lifecycle_mutex);
+    bool empty;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (!_channels.erase(pin)) {
+            return;
+        }
+
+        try {
+            _lines->setValue(pin, false);
+        } catch (const std::exception &e) {
+            Log::error("PWM Error on stop: ", e.what());
+        }
+
+        rebuildRequest();
+        empty = _channels.empty();
+    }
+
+    if (empty) {
+        stopThread();
+    }
+}
+
+void PwmScheduler::setPulseWidth(unsigned int pin, int pulse_width_us) {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _channels.find(pin);
+    if (it != _channels.end()) {
+        it->second.pulse_width_us = std::max(pulse_width_us, 0);
+    }
+}
+
+bool PwmScheduler::empty() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _channels.empty();
+}
+
+PwmScheduler::ChannelStats PwmScheduler::getStats(unsigned int pin) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _channels.find(pin);
+    return it != _channels.end() ? it->second.stats : ChannelStats();
+}
+
+// Lines can't be added to a live request, so the whole set is requested again. Lines come back
+// at the level last written so running servos don't see a stray edge. Caller holds _mutex.
+bool PwmScheduler::rebuildRequest() {
+    _lines.reset();
+
+    if (_channels.empty()) {
+        return true;
+    }
+
+    GpioBackend::LineConfig config;
+    for (const auto &channel : _channels) {
+        config.offsets.push_back(channel.first);
+        if (channel.second.active) {
+            config.active_offsets.push_back(channel.first);
+        }
+    }
+
+    try {
+        _lines = _backend.request(_chip_path, "servo_controller", config);
+    } catch (const std::exception &e) {
+        Log::error("PWM Error requesting lines: ", e.what());
+        return false;
+    }
+
+    return true;
+}
+
+void PwmScheduler::loop() {
+    RealTime::promoteCurrentThread(RealTime::Role::PWM);
+
+    uint64_t period_start = _backend.nowNs();
+
+    std::vector<std::pair<int, unsigned int>> falls;
+    GpioLines::Values values;
+    uint64_t rise_ns = 0;
+
+    while (_running) {
+        _backend.sleepUntilNs(period_start);
+
+        // Every active channel rises together at the start of the period
+        falls.clear();
+        values.clear();
+
+        try {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            for (const auto &channel : _channels) {
+                int pulse_width_us = channel.second.pulse_width_us;
+
+                values.emplace_back(channel.first, pulse_width_us > 0);
+                if (pulse_width_us > 0) {
+                    falls.emplace_back(pulse_width_us, channel.first);
+                }
+            }
+
+            uint64_t start = Utils::monotonicNs();
+            if (_lines && !values.empty()) {
+                _lines->setValues(values);
+                Metrics::recordSince(Metrics::Op::PWM_SET_VALUES, start);
+            }
+
+            for (auto &channel : _channels) {
+                channel.second.active = channel.second.pulse_width_us > 0;
+            }
+
+            // One write raises every line, so they share a rise time
+            rise_ns = _backend.nowNs();
+        } catch (const std::exception &e) {
+            Log::error("PWM Error in thread: ", e.what());
+            _running = false;
+            break;
+        }
+
+        // Falling edges in width order, channels with equal widths share one write
+        std::sort(falls.begin(), falls.end());
+
+        for (size_t i = 0; i < falls.size();) {
+            int pulse_width_us = falls[i].first;
+            _backend.sleepUntilNs(period_start + pulse_width_us * 1000ull);
+
+            try {
+                std::lock_guard<std::mutex> lock(_mutex);
+
+                values.clear();
+                size_t group_end = i;
+                for (; group_end < falls.size() && falls[group_end].first == pulse_width_us; group_end++) {
+                    if (_channels.count(falls[group_end].second)) {
+                        values.emplace_back(falls[group_end].second, false);
+                    }
+                }
+
+                uint64_t start = Utils::monotonicNs();
+                if (_lines && !values.empty()) {
+                    _lines->setValues(values);
+                    Metrics::recordSince(Metrics::Op::PWM_SET_VALUES, start);
+                }
+
+                uint64_t now = _backend.nowNs();
+                for (; i < group_end; i++) {
+                    auto channel = _channels.find(falls[i].second);
+                    if (channel == _channels.end()) {
+                        continue;
+                    }
+
+                    channel->second.active = false;
+
+                    ChannelStats &stats = channel->second.stats;
+                    int64_t error = (int64_t)(now - rise_ns) - pulse_width_us * 1000ll;
+
+                    stats.pulses++;
+                    stats.mean_error_ns += (error - stats.mean_error_ns) / stats.pulses;
+                    stats.max_error_ns = std::max(stats.max_error_ns, error < 0 ? -error : error);
+                }
+            } catch (const std::exception &e) {
+                Log::error("PWM Error in thread: ", e.what());
+                _running = false;
+                break;
+            }
+        }
+
+        period_start += _period_ns;
+
+        // After a stall, start the next period now rather than firing a burst of late ones
+        uint64_t now = _backend.nowNs();
+        if (now > period_start + _period_ns) {
+            period_start = now;
+        }
+    }
+}
+
+// Caller holds _lifecycle_mutex
+void PwmScheduler::stopThread() {
+    _running = false;
+
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
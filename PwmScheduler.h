@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "GpioBackend.h"
+
+// Generates the servo pulses of every channel on a chip from one thread. All lines
+// share a single request, edges that fall at the same time are written with one
+// setValues call, and each period is scheduled against absolute deadlines.
+class PwmScheduler {
+    public:
+        struct ChannelStats {
+            uint64_t pulses = 0;
+            double mean_error_ns = 0; // Measured minus requested pulse width
+            int64_t max_error_ns = 0; // Largest absolute error seen
+        };
+
+        // Adds pin to the scheduler shared by every channel on chip_path of backend, nullptr if the
+        // line can't be requested. The scheduler is destroyed when release() takes its last channel,
+        // so every channel must be released before its backend goes away
+        static PwmScheduler *acquire(const std::string &chip_path, unsigned int pin,
+                                     GpioBackend &backend = GpioBackend::defaultBackend());
+        static void release(PwmScheduler *scheduler, unsigned int pin);
+
+        explicit PwmScheduler(const std::string &chip_path, int period_us = 20000,
+                              GpioBackend &backend = GpioBackend::defaultBackend());
+        ~PwmScheduler();
+
+        PwmScheduler(const PwmScheduler&) = delete;
+        PwmScheduler& operator=(const PwmScheduler&) = delete;
+
+        bool addChannel(unsigned int pin);
+        void removeChannel(unsigned int pin);
+
+        // 0 holds the line low
+        void setPulseWidth(unsigned int pin, int pulse_width_us);
+        ChannelStats getStats(unsigned int pin) const;
+        bool empty() const;
+
+    private:
+        struct Channel {
+            int pulse_width_us = 0;
+            bool active = false; // Level last written to the line
+            ChannelStats stats;
+        };
+
+        GpioBackend &_backend;
+        const std::string _chip_path;
+        const uint64_t _period_ns;
+
+        mutable std::mutex _mutex;
+        std::map<unsigned int, Channel> _channels;
+        std::unique_ptr<GpioLines> _lines;
+
+        // Held over starting and stopping the thread, and taken before _mutex
+        std::mutex _lifecycle_mutex;
+        std::atomic<bool> _running;
+        std::thread _thread;
+
+        bool rebuildRequest();
+        void loop();
+        void stopThread();
+};
@@ -0,0 +1,287 @@
+#include "RealTime.h"
+#include "Log.h"
+
+#include <alloca.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+namespace RealTime {
+    static constexpr int CAP_IPC_LOCK_BIT = 14;
+    static constexpr int CAP_SYS_NICE_BIT = 23;
+
+    static std::mutex config_mutex;
+    static Config active_config;
+    static std::atomic<bool> configured{false};
+    static std::set<int> shared_cpus; // Cores more than one role is pinned to
+
+    static thread_local bool may_spin = true;
+
+    static uint64_t effectiveCapabilities() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+
+        while (std::getline(status, line)) {
+            if (line.compare(0, 7, "CapEff:") == 0) {
+                return std::stoull(line.substr(7), nullptr, 16);
+            }
+        }
+
+        return 0;
+    }
+
+    // Parses a kernel cpu list such as "2-3,6"
+    static bool cpuListed(const std::string &list, int cpu) {
+        std::stringstream ranges(list);
+        std::string range;
+
+        while (std::getline(ranges, range, ',')) {
+            if (range.empty() || range == "\n") {
+                continue;
+            }
+
+            size_t dash = range.find('-');
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+
+            if (cpu >= first && cpu <= last) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    static const char *roleName(Role role) {
+        switch (role) {
+            case Role::LIMIT_SWITCH: return "limit switch";
+            case Role::PWM: return "PWM scheduler";
+            case Role::STEP_PULSE: return "step pulse";
+            case Role::STEPPER_MOTION: return "stepper motion";
+            case Role::SHOW: return "show scheduler";
+            default: return "real-time";
+        }
+    }
+
+    static int roleCpu(const Config &config, Role role) {
+        auto cpu = config.role_cpus.find(role);
+        return cpu != config.role_cpus.end() ? cpu->second : config.cpu;
+    }
+
+    // Every core some role is pinned to
+    static std::set<int> pinnedCpus(const Config &config) {
+        std::set<int> cpus;
+
+        for (int role = 0; role < (int)Role::COUNT; role++) {
+            int cpu = roleCpu(config, (Role)role);
+            if (cpu >= 0) {
+                cpus.insert(cpu);
+            }
+        }
+
+        return cpus;
+    }
+
+    // CPU numbers can have gaps once some are offlined, and a cpuset can rule out others
+    static bool cpuAllowed(int cpu) {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+
+        return cpu < CPU_SETSIZE && sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_ISSET(cpu, &allowed);
+    }
+
+    static std::string isolatedCpus() {
+        std::ifstream isolated("/sys/devices/system/cpu/isolated");
+        std::string list;
+        std::getline(isolated, list);
+        return list;
+    }
+
+    Capabilities probe(const Config &config) {
+        Capabilities capabilities;
+        uint64_t effective = effectiveCapabilities();
+
+        rlimit rtprio = {};
+        getrlimit(RLIMIT_RTPRIO, &rtprio);
+        capabilities.can_set_priority = (effective >> CAP_SYS_NICE_BIT & 1) || rtprio.rlim_cur >= (rlim_t)config.priority;
+
+        rlimit memlock = {};
+        getrlimit(RLIMIT_MEMLOCK, &memlock);
+        capabilities.can_lock_memory = (effective >> CAP_IPC_LOCK_BIT & 1) || memlock.rlim_cur == RLIM_INFINITY;
+
+        std::set<int> cpus = pinnedCpus(config);
+        if (!cpus.empty()) {
+            std::string isolated = isolatedCpus();
+            capabilities.cpu_online = true;
+            capabilities.cpu_isolated = true;
+
+            for (int cpu : cpus) {
+                capabilities.cpu_online = capabilities.cpu_online && cpuAllowed(cpu);
+                capabilities.cpu_isolated = capabilities.cpu_isolated && cpuListed(isolated, cpu);
+            }
+        }
+
+        return capabilities;
+    }
+
+    bool configure(const Config &config) {
+        Capabilities capabilities = probe(config);
+        bool ok = true;
+
+        int max_priority = sched_get_priority_max(config.policy);
+        int min_priority = sched_get_priority_min(config.policy);
+        int lowest_priority = config.priority - ((int)Role::COUNT - 1);
+
+        if ((config.policy != SCHED_FIFO && config.policy != SCHED_RR) ||
+            lowest_priority < min_priority || config.priority > max_priority) {
+            Log::error("Real-time policy must be SCHED_FIFO or SCHED_RR with a priority from ",
+                       min_priority + (int)Role::COUNT - 1, " to ", max_priority);
+            return false;
+        }
+
+        if (!capabilities.can_set_priority) {
+            Log::warning("Real-time priority ", config.priority, " needs CAP_SYS_NICE or RLIMIT_RTPRIO, threads stay at normal priority");
+            ok = false;
+        }
+
+        Config applied = config;
+        if (!capabilities.can_set_priority) {
+            applied.priority = 0;
+        }
+
+        std::string isolated = isolatedCpus();
+        for (int cpu : pinnedCpus(config)) {
+            if (!cpuAllowed(cpu)) {
+                Log::warning("CPU ", cpu, " is not online, threads will not be pinned to it");
+                ok = false;
+
+                if (applied.cpu == cpu) {
+                    applied.cpu = -1;
+                }
+                for (auto &role_cpu : applied.role_cpus) {
+                    if (role_cpu.second == cpu) {
+                        role_cpu.second = -1;
+                    }
+                }
+            } else if (!cpuListed(isolated, cpu)) {
+                Log::warning("CPU ", cpu, " is not isolated (isolcpus), other tasks may still run on it");
+            }
+        }
+
+        // A spinning thread holds its core for the whole window, whatever its priority
+        std::map<int, int> roles_per_cpu;
+        for (int role = 0; role < (int)Role::COUNT; role++) {
+            int cpu = roleCpu(applied, (Role)role);
+            if (cpu >= 0) {
+                roles_per_cpu[cpu]++;
+            }
+        }
+        for (const auto &cpu : roles_per_cpu) {
+            if (cpu.second > 1) {
+                Log::warning("CPU ", cpu.first, " is shared by ", cpu.second, " real-time roles, threads on it won't busy-wait");
+            }
+        }
+
+        if (config.lock_memory) {
+            if (!capabilities.can_lock_memory) {
+                Log::warning("Locking memory needs CAP_IPC_LOCK or an unlimited RLIMIT_MEMLOCK, page faults may stall deadlines");
+                ok = false;
+            } else if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+                Log::warning("mlockall failed: ", strerror(errno));
+                ok = false;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(config_mutex);
+            active_config = applied;
+            shared_cpus.clear();
+            for (const auto &cpu : roles_per_cpu) {
+                if (cpu.second > 1) {
+                    shared_cpus.insert(cpu.first);
+                }
+            }
+        }
+
+        configured = true;
+        return ok;
+    }
+
+    bool enabled() {
+        return configured;
+    }
+
+    // Touches the stack now so the first deep call on a deadline doesn't fault pages in
+    static void prefaultStack(size_t size) {
+        volatile unsigned char *stack = static_cast<unsigned char *>(alloca(size));
+
+        for (size_t i = 0; i < size; i += 4096) {
+            stack[i] = 0;
+        }
+    }
+
+    bool promoteCurrentThread(Role role) {
+        if (!configured) {
+            return true;
+        }
+
+        Config config;
+        bool shared_cpu;
+        {
+            std::lock_guard<std::mutex> lock(config_mutex);
+            config = active_config;
+            shared_cpu = shared_cpus.count(roleCpu(config, role)) != 0;
+        }
+
+        const char *name = roleName(role);
+        int cpu = roleCpu(config, role);
+        bool ok = true;
+
+        if (config.priority > 0) {
+            sched_param param = {};
+            param.sched_priority = config.priority - (int)role;
+
+            int error = pthread_setschedparam(pthread_self(), config.policy, &param);
+            if (error != 0) {
+                Log::warning("Couldn't make the ", name, " thread real-time: ", strerror(error));
+                ok = false;
+            }
+        }
+
+        if (cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(cpu, &cpus);
+
+            int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            if (error != 0) {
+                Log::warning("Couldn't pin the ", name, " thread to CPU ", cpu, ": ", strerror(error));
+                ok = false;
+            } else {
+                may_spin = !shared_cpu;
+            }
+        }
+
+        if (config.stack_prefault > 0) {
+            prefaultStack(config.stack_prefault);
+        }
+
+        return ok;
+    }
+
+    bool spinAllowed() {
+        return may_spin;
+    }
+}
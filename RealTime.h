@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <sched.h>
+
+// Opt-in real-time execution for the timing-critical threads (limit switch watchers, PWM
+// scheduler, stepper motion and pulse threads, show scheduler). Nothing changes until
+// configure() is called; after that each of those threads promotes itself as it starts. Wakeup
+// lateness of every absolute sleep is recorded as Metrics::Op::WAKEUP_LATENCY either way, so
+// runs with and without it can be compared.
+namespace RealTime {
+    // Most urgent first. Each role runs one priority below the one before it, so a tripped
+    // limit switch always preempts motion
+    enum class Role {
+        LIMIT_SWITCH,
+        PWM,
+        STEP_PULSE,
+        STEPPER_MOTION,
+        SHOW,
+        COUNT
+    };
+
+    struct Config {
+        int policy = SCHED_FIFO; // Or SCHED_RR
+        int priority = 80; // Of LIMIT_SWITCH, the lowest role gets priority - 4
+        int cpu = -1; // Core to pin to, ideally one listed in isolcpus. -1 leaves affinity alone
+        std::map<Role, int> role_cpus; // Per-role cores, overriding cpu
+        bool lock_memory = true; // mlockall so page faults never stall a deadline
+        size_t stack_prefault = 256 * 1024; // Bytes of stack touched when a thread promotes itself
+    };
+
+    struct Capabilities {
+        bool can_set_priority = false; // CAP_SYS_NICE or a high enough RLIMIT_RTPRIO
+        bool can_lock_memory = false; // CAP_IPC_LOCK or an unlimited RLIMIT_MEMLOCK
+        bool cpu_online = false; // Every configured core is online and in this process's affinity mask
+        bool cpu_isolated = false;
+    };
+
+    // What this process is allowed to do with config, without changing anything
+    Capabilities probe(const Config &config);
+
+    // Checks capabilities, warns about anything missing and locks memory. Returns false if
+    // any part of the config can't be applied; the rest still is
+    bool configure(const Config &config);
+    bool enabled();
+
+    // Applies the role's policy, priority and affinity to the calling thread and prefaults
+    // its stack. Does nothing unless configured
+    bool promoteCurrentThread(Role role);
+
+    // False when the calling thread is pinned to a core another role is pinned to as well,
+    // where busy-waiting would starve it. Threads that weren't promoted may always spin
+    bool spinAllowed();
+}
@@ -0,0 +1,280 @@
+#include "ShowPlayer.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include "Controller.h"
+#include "Log.h"
+#include "MagnetController.h"
+#include "Metrics.h"
+#include "MotorController.h"
+#include "RealTime.h"
+#include "StepperController.h"
+#include "Utils.h"
+
+ShowPlayer::ShowPlayer(const Timeline &timeline) : _timeline(timeline) {
+    for (size_t i = 0; i < timeline.channelCount(); i++) {
+        _workers.push_back(std::make_unique<Worker>());
+    }
+}
+
+ShowPlayer::~ShowPlayer() {
+    stop();
+    wait();
+}
+
+ShowPlayer::Worker *ShowPlayer::bindable(const std::string &channel, Timeline::ChannelKind kind) {
+    int index = _timeline.findChannel(channel);
+
+    if (index == -1) {
+        Log::error("Show has no channel ", channel);
+        return nullptr;
+    } else if (_timeline.channel(index).kind != kind) {
+        Log::error("Show channel ", channel, " is a ", Timeline::kindName(_timeline.channel(index).kind),
+                   " channel, not a ", Timeline::kindName(kind), " channel");
+        return nullptr;
+    }
+
+    return _workers[index].get();
+}
+
+bool ShowPlayer::bind(const std::string &channel, MotorController &motor) {
+    Worker *worker = bindable(channel, Timeline::ChannelKind::MOTOR);
+    if (!worker) {
+        return false;
+    }
+
+    worker->motor = &motor;
+    return true;
+}
+
+bool ShowPlayer::bind(const std::string &channel, StepperController &stepper) {
+    Worker *worker = bindable(channel, Timeline::ChannelKind::STEPPER);
+    if (!worker) {
+        return false;
+    }
+
+    worker->stepper = &stepper;
+    return true;
+}
+
+bool ShowPlayer::bind(const std::string &channel, MagnetController &magnet) {
+    Worker *worker = bindable(channel, Timeline::ChannelKind::MAGNET);
+    if (!worker) {
+        return false;
+    }
+
+    worker->magnet = &magnet;
+    return true;
+}
+
+bool ShowPlayer::bind(const std::string &channel, Controller &servo) {
+    Worker *worker = bindable(channel, Timeline::ChannelKind::SERVO);
+    if (!worker) {
+        return false;
+    }
+
+    worker->servo = &servo;
+    return true;
+}
+
+bool ShowPlayer::start() {
+    if (_thread.joinable()) {
+        Log::error("Show is already playing");
+        return false;
+    }
+
+    for (size_t i = 0; i < _timeline.cueCount(); i++) {
+        const Worker &worker = *_workers[_timeline.cue(i).channel];
+
+        if (!worker.motor && !worker.stepper && !worker.magnet && !worker.servo) {
+            Log::error("Show channel ", _timeline.channel(_timeline.cue(i).channel).name, " has cues but no device");
+            return false;
+        }
+    }
+
+    uint64_t lead_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(_modbus_lead).count();
+    if (lead_ns == 0) {
+        Metrics::Histogram writes = Metrics::snapshot(Metrics::Op::MODBUS_WRITE_32);
+        lead_ns = writes.count ? writes.percentile(50) / 2 : std::chrono::nanoseconds(DEFAULT_MODBUS_LEAD).count();
+    }
+
+    // The origin is pushed out far enough for cues at 0 to get their full lead
+    uint64_t origin_ns = Utils::monotonicNs() + lead_ns + std::chrono::nanoseconds(PRECISE_WINDOW).count();
+
+    std::vector<Job> jobs;
+    jobs.reserve(_timeline.cueCount());
+
+    for (size_t i = 0; i < _timeline.cueCount(); i++) {
+        const Timeline::Cue &cue = _timeline.cue(i);
+        bool modbus = Timeline::actionKind(cue.action) == Timeline::ChannelKind::MOTOR;
+
+        jobs.push_back({&cue, origin_ns + cue.time_ns - (modbus ? lead_ns : 0)});
+    }
+
+    // Leads can reorder cues that are close together
+    std::stable_sort(jobs.begin(), jobs.end(), [](const Job &a, const Job &b) {
+        return a.deadline_ns < b.deadline_ns;
+    });
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        _stats = Stats();
+        _lateness_sum_ns = 0;
+    }
+
+    for (auto &worker : _workers) {
+        worker->done = false;
+        worker->thread = std::thread(&ShowPlayer::work, this, std::ref(*worker));
+    }
+
+    _thread = std::thread(&ShowPlayer::schedule, this, std::move(jobs));
+    return true;
+}
+
+ShowPlayer::Stats ShowPlayer::wait() {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(_stats_mutex);
+    return _stats;
+}
+
+ShowPlayer::Stats ShowPlayer::play() {
+    if (!start()) {
+        return Stats();
+    }
+
+    return wait();
+}
+
+void ShowPlayer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _cv.notify_all();
+
+    for (auto &worker : _workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->jobs.clear();
+        }
+
+        if (worker->stepper) {
+            worker->stepper->abort();
+        }
+    }
+}
+
+bool ShowPlayer::waitUntil(uint64_t deadline_ns) {
+    using namespace std::chrono;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        steady_clock::time_point coarse(nanoseconds(deadline_ns) - PRECISE_WINDOW);
+
+        if (_cv.wait_until(lock, coarse, [this] { return _stopping; })) {
+            return false;
+        }
+    }
+
+    Utils::sleepUntilNs(deadline_ns);
+    return true;
+}
+
+void ShowPlayer::schedule(std::vector<Job> jobs) {
+    RealTime::promoteCurrentThread(RealTime::Role::SHOW);
+
+    for (const Job &job : jobs) {
+        if (!waitUntil(job.deadline_ns)) {
+            break;
+        }
+
+        Worker &worker = *_workers[job.cue->channel];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.jobs.push_back(job);
+        }
+        worker.cv.notify_one();
+    }
+
+    for (auto &worker : _workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->done = true;
+        }
+        worker->cv.notify_one();
+    }
+
+    for (auto &worker : _workers) {
+        worker->thread.join();
+    }
+}
+
+void ShowPlayer::work(Worker &worker) {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.cv.wait(lock, [&worker] { return !worker.jobs.empty() || worker.done; });
+
+            if (worker.jobs.empty()) {
+                return;
+            }
+
+            job = worker.jobs.front();
+            worker.jobs.pop_front();
+        }
+
+        int64_t lateness_ns = (int64_t)(Utils::monotonicNs() - job.deadline_ns);
+        execute(worker, *job.cue);
+
+        std::lock_guard<std::mutex> lock(_stats_mutex);
+        _stats.cues++;
+        _stats.max_lateness_ns = std::max(_stats.max_lateness_ns, lateness_ns);
+        _lateness_sum_ns += lateness_ns;
+        _stats.mean_lateness_ns = _lateness_sum_ns / _stats.cues;
+    }
+}
+
+void ShowPlayer::execute(Worker &worker, const Timeline::Cue &cue) {
+    bool ok = true;
+
+    switch (cue.action) {
+        case Timeline::Action::MOTOR_POSITION:
+            ok = worker.motor->setAbsolutePosition(cue.args[0]);
+            break;
+        case Timeline::Action::MOTOR_INITIAL_VELOCITY:
+            ok = worker.motor->setInitialVelocity(cue.args[0]);
+            break;
+        case Timeline::Action::MOTOR_MAX_VELOCITY:
+            ok = worker.motor->setMaxVelocity(cue.args[0]);
+            break;
+        case Timeline::Action::STEPPER_MOVE:
+            worker.stepper->move(std::abs(cue.args[0]), cue.args[0] >= 0, cue.args[1]);
+            break;
+        case Timeline::Action::STEPPER_ENABLE:
+            worker.stepper->setEnabled(cue.args[0] != 0);
+            break;
+        case Timeline::Action::MAGNET_SET:
+            worker.magnet->set(cue.args[0] != 0);
+            break;
+        case Timeline::Action::SERVO_SPEED:
+            worker.servo->setSpeed(cue.args[0]);
+            break;
+        case Timeline::Action::SERVO_STOP:
+            worker.servo->stop();
+            break;
+    }
+
+    if (!ok) {
+        Log::warning("Show cue at ", cue.time_ns / 1e9, "s on channel ", _timeline.channel(cue.channel).name, " failed");
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Timeline.h"
+
+class MotorController;
+class StepperController;
+class MagnetController;
+class Controller;
+
+// Plays a Timeline against bound devices. One scheduler thread sleeps to each cue's absolute
+// CLOCK_MONOTONIC deadline and hands it to the channel's own worker thread, so a slow Modbus
+// write or a long stepper move never delays another channel. Motor cues are dispatched early
+// by the Modbus lead so the write reaches the drive on cue rather than a round trip late.
+class ShowPlayer {
+    public:
+        struct Stats {
+            uint64_t cues = 0; // Cues executed, fewer than scheduled if stopped
+            int64_t max_lateness_ns = 0; // How far past its dispatch deadline a cue started
+            double mean_lateness_ns = 0;
+        };
+
+        explicit ShowPlayer(const Timeline &timeline);
+        ~ShowPlayer();
+
+        ShowPlayer(const ShowPlayer&) = delete;
+        ShowPlayer& operator=(const ShowPlayer&) = delete;
+
+        // False if the show has no such channel or it is of another kind
+        bool bind(const std::string &channel, MotorController &motor);
+        bool bind(const std::string &channel, StepperController &stepper);
+        bool bind(const std::string &channel, MagnetController &magnet);
+        bool bind(const std::string &channel, Controller &servo);
+
+        // Zero, the default, uses half the median measured Modbus write round trip
+        void setModbusLead(std::chrono::microseconds lead) { _modbus_lead = lead; }
+
+        // False if already playing or a channel with cues is unbound
+        bool start();
+        Stats wait();
+        Stats play();
+
+        // Safe from any thread: no further cues are dispatched and running stepper moves abort
+        void stop();
+
+    private:
+        // Before this, the scheduler waits on a condition variable so stop() can wake it
+        static constexpr std::chrono::microseconds PRECISE_WINDOW{1000};
+        static constexpr std::chrono::microseconds DEFAULT_MODBUS_LEAD{1000};
+
+        struct Job {
+            const Timeline::Cue *cue;
+            uint64_t deadline_ns;
+        };
+
+        struct Worker {
+            MotorController *motor = nullptr;
+            StepperController *stepper = nullptr;
+            MagnetController *magnet = nullptr;
+            Controller *servo = nullptr;
+
+            std::thread thread;
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<Job> jobs;
+            bool done = false;
+        };
+
+        const Timeline &_timeline;
+        std::vector<std::unique_ptr<Worker>> _workers;
+        std::chrono::microseconds _modbus_lead{0};
+
+        std::thread _thread;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _stopping = false;
+
+        std::mutex _stats_mutex;
+        Stats _stats;
+        double _lateness_sum_ns = 0;
+
+        Worker *bindable(const std::string &channel, Timeline::ChannelKind kind);
+        bool waitUntil(uint64_t deadline_ns);
+        void schedule(std::vector<Job> jobs);
+        void work(Worker &worker);
+        void execute(Worker &worker, const Timeline::Cue &cue);
+};
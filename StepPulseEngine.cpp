@@ -0,0 +1,84 @@
+#include "StepPulseEngine.h"
+#include "RealTime.h"
+
+#include <algorithm>
+#include <cmath>
+
+StepPulseEngine::StepPulseEngine(std::chrono::nanoseconds spin_window, Clock &clock)
+    : _spin_window(spin_window),
+      _clock(clock),
+      _cancelled(false)
+{}
+
+StepPulseEngine::~StepPulseEngine() {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void StepPulseEngine::start(std::vector<uint64_t> edge_offsets_ns, EdgeFunction edge) {
+    wait();
+
+    _edges = std::move(edge_offsets_ns);
+    _edge = std::move(edge);
+    _stats = Stats();
+    _cancelled = false;
+    _thread = std::thread(&StepPulseEngine::loop, this);
+}
+
+StepPulseEngine::Stats StepPulseEngine::wait() {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+
+    return _stats;
+}
+
+StepPulseEngine::Stats StepPulseEngine::run(std::vector<uint64_t> edge_offsets_ns, EdgeFunction edge) {
+    start(std::move(edge_offsets_ns), std::move(edge));
+    return wait();
+}
+
+void StepPulseEngine::loop() {
+    RealTime::promoteCurrentThread(RealTime::Role::STEP_PULSE);
+
+    _stats = emit(_clock.nowNs(), _edges, _edge, [this](size_t) {
+        return _cancelled.load();
+    });
+}
+
+StepPulseEngine::Stats StepPulseEngine::emit(uint64_t base_ns, const std::vector<uint64_t> &edge_offsets_ns, const EdgeFunction &edge,
+                                             const std::function<bool (size_t edge)> &stop) const {
+    const uint64_t spin_ns = RealTime::spinAllowed() ? _spin_window.count() : 0;
+    Stats stats;
+
+    double mean = 0;
+    double m2 = 0;
+
+    size_t i = 0;
+    for (; i < edge_offsets_ns.size(); i++) {
+        uint64_t deadline = base_ns + edge_offsets_ns[i];
+
+        _clock.sleepUntilNs(deadline, spin_ns);
+        uint64_t now = _clock.nowNs();
+
+        if (stop(i)) {
+            break;
+        }
+
+        edge(i);
+
+        // Welford's running mean and variance of how late each edge fired
+        double lateness = (double)(now - deadline);
+        double delta = lateness - mean;
+        mean += delta / (i + 1);
+        m2 += delta * (lateness - mean);
+
+        stats.max_lateness_ns = std::max(stats.max_lateness_ns, (int64_t)(now - deadline));
+    }
+
+    stats.edges = i;
+    stats.mean_lateness_ns = mean;
+    stats.jitter_ns = i == 0 ? 0 : std::sqrt(m2 / i);
+    return stats;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "GpioBackend.h"
+
+// Emits a precomputed list of edges on a dedicated thread, sleeping to absolute
+// deadlines on its clock so per-edge overhead never accumulates into drift.
+class StepPulseEngine {
+    public:
+        struct Stats {
+            uint64_t edges = 0; // Edges actually emitted, fewer than scheduled if cancelled
+            int64_t max_lateness_ns = 0;
+            double mean_lateness_ns = 0;
+            double jitter_ns = 0; // Standard deviation of the lateness
+        };
+
+        using EdgeFunction = std::function<void (size_t edge)>;
+
+        // Deadlines closer than spin_window are busy-waited instead of slept, unless
+        // RealTime::spinAllowed() says the thread shares its core
+        explicit StepPulseEngine(std::chrono::nanoseconds spin_window = std::chrono::nanoseconds(0),
+                                 Clock &clock = GpioBackend::defaultBackend());
+        ~StepPulseEngine();
+
+        StepPulseEngine(const StepPulseEngine&) = delete;
+        StepPulseEngine& operator=(const StepPulseEngine&) = delete;
+
+        // edge_offsets_ns are relative to the start of the run and must be ascending
+        void start(std::vector<uint64_t> edge_offsets_ns, EdgeFunction edge);
+        Stats wait();
+        Stats run(std::vector<uint64_t> edge_offsets_ns, EdgeFunction edge);
+
+        // Emits on the calling thread, offsets are from base_ns so consecutive schedules can be
+        // chained without a gap. Stops before edge i when stop(i) returns true; cancel() is ignored
+        Stats emit(uint64_t base_ns, const std::vector<uint64_t> &edge_offsets_ns, const EdgeFunction &edge,
+                   const std::function<bool (size_t edge)> &stop) const;
+
+        // Safe from any thread, the running schedule stops before its next edge
+        void cancel() { _cancelled = true; }
+
+        void setSpinWindow(std::chrono::nanoseconds spin_window) { _spin_window = spin_window; }
+
+    private:
+        std::chrono::nanoseconds _spin_window;
+        Clock &_clock;
+        std::thread _thread;
+        std::vector<uint64_t> _edges;
+        EdgeFunction _edge;
+        Stats _stats;
+        std::atomic<bool> _cancelled;
+
+        void loop();
+};
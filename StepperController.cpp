@@ -1,5 +1,9 @@
 #include "StepperController.h"
 #include "Utils.h"
+#include "Metrics.h"
+#include "RealTime.h"
+#include <algorithm>
+#include <stdexcept>
 #include <thread>
 #include <chrono>
 #include <math.h>
@@ -10,44 +14,233 @@ StepperController::StepperController(unsigned int step_pin,
                                      unsigned int dir_pin,
                                      unsigned int enable_pin,
                                      unsigned int microstep_pins[4],
-                                     const std::string &chip_path)
-    : _chip(chip_path),
+                                     const std::string &chip_path,
+                                     GpioBackend &backend)
+    : _backend(backend),
       _step_offset(step_pin),
       _dir_offset(dir_pin),
       _enable_offset(enable_pin),
       _microstep_offsets(microstep_pins),
 
-      _request(_chip.prepare_request()
-                .set_request_config(gpiod::request_config().set_consumer("stepper_ctrl"))
-                .add_line_settings(
-                    {step_pin, dir_pin},
-                    gpiod::line_settings()
-                        .set_direction(gpiod::line::direction::OUTPUT)
-                        .set_output_value(gpiod::line::value::INACTIVE)
-                )
-                .do_request()) 
+      _lines(backend.request(chip_path, "stepper_ctrl", {{step_pin, dir_pin, microstep_pins[0], microstep_pins[1],
+                                                         microstep_pins[2], microstep_pins[3]}})),
+      // The enable input is active low, so it is requested high and the driver starts out off
+      _enable_line(backend.request(chip_path, "stepper_enable", {{enable_pin}, true, true})),
+      _engine(std::chrono::nanoseconds(0), backend)
 {}
 
+StepperController::~StepperController() {
+    {
+        std::lock_guard<std::mutex> lock(_motion_mutex);
+        _shutting_down = true;
+    }
+
+    halt(StopMode::IMMEDIATE);
+    _motion_cv.notify_all();
+
+    if (_motion_thread.joinable()) {
+        _motion_thread.join();
+    }
+}
+
+std::future<StepperController::MoveResult> StepperController::moveAsync(int steps, bool clockwise, int delay_us) {
+    uint32_t period_ns;
+    if (!MotionProfile::cruisePeriodNs(delay_us, period_ns)) {
+        throw std::invalid_argument("StepperController::moveAsync delay_us is out of range");
+    }
+
+    Telemetry::record(_telemetry_source, Telemetry::Kind::STEPPER_MOVE, clockwise ? steps : -steps, delay_us);
+
+    Segment segment = {steps, clockwise, period_ns, 0, MotionProfile::Shape::TRAPEZOIDAL, std::promise<MoveResult>()};
+    std::future<MoveResult> result = segment.promise.get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(_motion_mutex);
+        segment.acceleration = _acceleration;
+        segment.ramp_shape = _ramp_shape;
+        _segments.push_back(std::move(segment));
+
+        if (!_motion_thread.joinable()) {
+            _motion_thread = std::thread(&StepperController::motionLoop, this);
+        }
+    }
+
+    _motion_cv.notify_one();
+    return result;
+}
+
 void StepperController::move(int steps, bool clockwise, int delay_us) {
+    moveAsync(steps, clockwise, delay_us).wait();
+}
+
+void StepperController::abort() {
+    Telemetry::record(_telemetry_source, Telemetry::Kind::STEPPER_ABORT);
+    halt(StopMode::IMMEDIATE);
+}
+
+void StepperController::stop() {
+    Telemetry::record(_telemetry_source, Telemetry::Kind::STEPPER_STOP);
+    halt(StopMode::RAMPED);
+}
+
+void StepperController::halt(StopMode mode) {
+    std::deque<Segment> dropped;
+    {
+        std::lock_guard<std::mutex> lock(_motion_mutex);
+        dropped.swap(_segments);
+
+        if (_moving) {
+            _stop_mode = mode;
+        }
+    }
+
+    for (Segment &segment : dropped) {
+        MoveResult result;
+        result.outcome = MoveResult::Outcome::CANCELLED;
+        segment.promise.set_value(result);
+    }
+}
+
+StepPulseEngine::Stats StepperController::getLastMoveStats() {
+    std::lock_guard<std::mutex> lock(_motion_mutex);
+    return _last_move_stats;
+}
+
+void StepperController::motionLoop() {
+    RealTime::promoteCurrentThread(RealTime::Role::STEPPER_MOTION);
+
+    std::unique_lock<std::mutex> lock(_motion_mutex);
+
+    while (true) {
+        _motion_cv.wait(lock, [this] { return !_segments.empty() || _shutting_down; });
+
+        if (_segments.empty()) {
+            return;
+        }
+
+        Segment segment = std::move(_segments.front());
+        _segments.pop_front();
+        _moving = true;
+        _stop_mode = StopMode::NONE;
+        lock.unlock();
+
+        MoveResult result = runSegment(segment);
+
+        lock.lock();
+        _moving = false;
+        _last_move_stats = result.stats;
+        segment.promise.set_value(result);
+    }
+}
+
+StepperController::MoveResult StepperController::runSegment(const Segment &segment) {
+    int steps = segment.steps;
+    bool clockwise = segment.clockwise;
     if (steps <= 0) clockwise = !clockwise;
 
-    _request.set_value(_dir_offset, clockwise ? gpiod::line::value::ACTIVE 
-                                              : gpiod::line::value::INACTIVE);
-    
-    std::this_thread::sleep_for(microseconds(10));
+    uint64_t now = _backend.nowNs();
+    uint64_t base = std::max(_next_edge_ns, now);
 
-    auto delay = microseconds(delay_us);
+    if (_direction != (int)clockwise) {
+        _lines->setValue(_dir_offset, clockwise);
+        _direction = clockwise;
+        base = std::max(base, now + DIR_SETUP_NS);
+    }
 
+    // Edge times are laid out up front so the motion thread only sleeps and toggles
+    MotionProfile profile(segment.period_ns, segment.acceleration, segment.ramp_shape);
+
+    std::vector<uint64_t> edges;
+    edges.reserve(steps > 0 ? steps * 2 : 0);
+
+    uint64_t edge_time_ns = 0;
     for (int i = 0; i < steps; ++i) {
-        _request.set_value(_step_offset, gpiod::line::value::ACTIVE);
-        std::this_thread::sleep_for(delay);
-        
-        _request.set_value(_step_offset, gpiod::line::value::INACTIVE);
-        std::this_thread::sleep_for(delay);
-
-        delay_us = Utils::lerp(delay_us, delay_us, 1);
-        delay = microseconds(delay_us);
+        uint32_t period_ns = profile.periodNs(i, steps);
+
+        edges.push_back(edge_time_ns);
+        edges.push_back(edge_time_ns + period_ns / 2);
+        edge_time_ns += period_ns;
+    }
+
+    uint64_t last_rise_ns = 0;
+
+    auto edge = [this, &last_rise_ns](size_t edge) {
+        uint64_t start = Utils::monotonicNs();
+
+        _lines->setValue(_step_offset, edge % 2 == 0);
+        Metrics::recordSince(Metrics::Op::STEP_SET_VALUE, start);
+
+        // Periods are measured on the backend's clock, which a simulator runs on virtual time
+        if (edge % 2 == 0) {
+            uint64_t rise_ns = _backend.nowNs();
+            if (last_rise_ns) {
+                Metrics::record(Metrics::Op::STEP_PERIOD, rise_ns - last_rise_ns);
+            }
+            last_rise_ns = rise_ns;
+        }
+    };
+
+    // A ramped stop waits for a step to complete, an immediate one takes the next edge
+    MoveResult result;
+    result.stats = _engine.emit(base, edges, edge, [this](size_t edge) {
+        StopMode mode = _stop_mode;
+        return mode == StopMode::IMMEDIATE || (mode == StopMode::RAMPED && edge % 2 == 0);
+    });
+    result.steps = (result.stats.edges + 1) / 2;
+
+    if (result.stats.edges == edges.size()) {
+        _next_edge_ns = base + edge_time_ns;
+    } else if (_stop_mode == StopMode::RAMPED) {
+        // Walk back down the ramp from wherever the move had got to, starting on the edge it was stopped at
+        size_t ramp_steps = std::min<size_t>({(size_t)result.steps, profile.rampLength(), (size_t)(steps - result.steps)});
+
+        std::vector<uint64_t> decel;
+        decel.reserve(ramp_steps * 2);
+
+        uint64_t decel_time_ns = 0;
+        for (size_t i = ramp_steps; i > 0; --i) {
+            uint32_t period_ns = profile.rampPeriodNs(i - 1);
+
+            decel.push_back(decel_time_ns);
+            decel.push_back(decel_time_ns + period_ns / 2);
+            decel_time_ns += period_ns;
+        }
+
+        StepPulseEngine::Stats decel_stats = _engine.emit(base + edges[result.stats.edges], decel, edge, [this](size_t) {
+            return _stop_mode == StopMode::IMMEDIATE;
+        });
+
+        StepPulseEngine::Stats &stats = result.stats;
+        uint64_t total = stats.edges + decel_stats.edges;
+        if (total > 0) {
+            stats.mean_lateness_ns = (stats.mean_lateness_ns * stats.edges + decel_stats.mean_lateness_ns * decel_stats.edges) / total;
+        }
+        stats.max_lateness_ns = std::max(stats.max_lateness_ns, decel_stats.max_lateness_ns);
+        stats.jitter_ns = std::max(stats.jitter_ns, decel_stats.jitter_ns);
+        stats.edges = total;
+
+        result.outcome = MoveResult::Outcome::STOPPED;
+        result.steps += (decel_stats.edges + 1) / 2;
+        _next_edge_ns = 0;
+    } else {
+        result.outcome = MoveResult::Outcome::CANCELLED;
+        _next_edge_ns = 0;
     }
+
+    // A stopped move can end between the rising and falling edge
+    _lines->setValue(_step_offset, false);
+
+    return result;
+}
+
+void StepperController::setAcceleration(uint32_t steps_per_s2, MotionProfile::Shape shape) {
+    std::lock_guard<std::mutex> lock(_motion_mutex);
+    _acceleration = steps_per_s2;
+    _ramp_shape = shape;
+}
+
+void StepperController::setBusyWait(microseconds window) {
+    _engine.setSpinWindow(window);
 }
 
 void StepperController::setMicrostep(short value) {
@@ -55,15 +248,14 @@ void StepperController::setMicrostep(short value) {
     short bits[] = {Utils::getBit(value, 1), Utils::getBit(value, 2), Utils::getBit(value, 4), Utils::getBit(value, 8)};
 
     for (int i = 0; i < 4; i++) {
-        _request.set_value(
-            _microstep_offsets[i], bits[i] == pow(i, 2) ? gpiod::line::value::INACTIVE : gpiod::line::value::ACTIVE
-        );
+        _lines->setValue(_microstep_offsets[i], bits[i] != pow(i, 2));
     }
 }
 
 void StepperController::setEnabled(bool value) {
     _enabled = value;
-    _request.set_value(_enable_offset, value ? gpiod::line::value::INACTIVE : gpiod::line::value::ACTIVE);
+    Telemetry::record(_telemetry_source, Telemetry::Kind::STEPPER_ENABLE, value);
+    _enable_line->setValue(_enable_offset, !value);
 }
 
 bool StepperController::isEnabled() {
@@ -1,30 +1,122 @@
 #pragma once
 
-#include <gpiod.hpp>
 #include <string>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+
+#include "GpioBackend.h"
+#include "StepPulseEngine.h"
+#include "Telemetry.h"
+#include "MotionProfile.h"
 
 class StepperController {
     public:
+        struct MoveResult {
+            enum class Outcome {
+                COMPLETED,
+                CANCELLED, // By abort(), or dropped from the queue before it started
+                STOPPED // Decelerated to rest by stop()
+            };
+
+            Outcome outcome = Outcome::COMPLETED;
+            int steps = 0; // Steps made, including the deceleration of a ramped stop
+            StepPulseEngine::Stats stats;
+        };
+
         StepperController(
             unsigned int step_pin,
             unsigned int dir_pin,
             unsigned int enable_pin,
             unsigned int microstep_pins[4],
-            const std::string &chip_path
+            const std::string &chip_path,
+            GpioBackend &backend = GpioBackend::defaultBackend()
         );
+        ~StepperController();
+
+        // Moves run one after another on the controller's motion thread. A move queued while
+        // another is running starts on the step edge after it ends, with no gap unless the
+        // direction changes. Throws std::invalid_argument for a delay_us outside
+        // 0..MotionProfile::MAX_DELAY_US
+        std::future<MoveResult> moveAsync(int steps, bool clockwise, int delay_us);
+        // Blocks until the move has finished
         void move(int steps, bool clockwise, int delay_us);
+
+        // Both are safe from any thread and drop every queued move. abort() stops the running
+        // move before its next step edge, stop() decelerates it to rest along its ramp
+        void abort();
+        void stop();
         void setMicrostep(short value);
         void setEnabled(bool value);
 
         bool isEnabled();
 
+        // Ramp up to and down from the commanded speed, 0 steps/s^2 moves at full speed throughout.
+        // Applies to moves queued after the call
+        void setAcceleration(uint32_t steps_per_s2, MotionProfile::Shape shape = MotionProfile::Shape::TRAPEZOIDAL);
+
+        // Busy-wait the last stretch before each edge, needed for step rates above a few kHz
+        void setBusyWait(std::chrono::microseconds window);
+        StepPulseEngine::Stats getLastMoveStats();
+
+        // Set by Telemetry::Recorder::add, commands are recorded under this source
+        void setTelemetrySource(Telemetry::Source source) { _telemetry_source = source; }
+
     private:
-        gpiod::chip _chip;
+        GpioBackend &_backend;
         unsigned int _step_offset;
         unsigned int _dir_offset;
         unsigned int _enable_offset;
         unsigned int *_microstep_offsets;
-        gpiod::line_request _request;
+        std::unique_ptr<GpioLines> _lines;
+        std::unique_ptr<GpioLines> _enable_line;
+
+        bool _enabled = false;
+        Telemetry::Source _telemetry_source = Telemetry::NO_SOURCE;
+
+        // Guarded by _motion_mutex, each move takes a copy when it is queued
+        uint32_t _acceleration = 0;
+        MotionProfile::Shape _ramp_shape = MotionProfile::Shape::TRAPEZOIDAL;
+
+        // Direction setup time before the first step edge
+        static constexpr uint64_t DIR_SETUP_NS = 10000;
+
+        enum class StopMode {
+            NONE,
+            RAMPED,
+            IMMEDIATE
+        };
+
+        struct Segment {
+            int steps;
+            bool clockwise;
+            uint32_t period_ns;
+            uint32_t acceleration;
+            MotionProfile::Shape ramp_shape;
+            std::promise<MoveResult> promise;
+        };
+
+        StepPulseEngine _engine;
+        StepPulseEngine::Stats _last_move_stats;
+
+        std::thread _motion_thread;
+        std::mutex _motion_mutex;
+        std::condition_variable _motion_cv;
+        std::deque<Segment> _segments;
+        bool _moving = false;
+        bool _shutting_down = false;
+        std::atomic<StopMode> _stop_mode{StopMode::NONE};
+
+        // Motion thread only: where a chained move may place its first edge
+        uint64_t _next_edge_ns = 0;
+        int _direction = -1;
 
-        bool _enabled;
+        void halt(StopMode mode);
+        void motionLoop();
+        MoveResult runSegment(const Segment &segment);
 };
\ No newline at end of file
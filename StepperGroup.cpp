@@ -0,0 +1,116 @@
+#include "StepperGroup.h"
+#include "Metrics.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+
+using namespace std::chrono;
+
+StepperGroup::StepperGroup(const std::vector<Axis> &axes, const std::string &chip_path, GpioBackend &backend)
+    : _backend(backend),
+      _axes(axes),
+      _lines(backend.request(chip_path, "stepper_group", lineConfig(axes))),
+      _engine(std::chrono::nanoseconds(0), backend)
+{}
+
+GpioBackend::LineConfig StepperGroup::lineConfig(const std::vector<Axis> &axes) {
+    GpioBackend::LineConfig config;
+
+    for (const Axis &axis : axes) {
+        config.offsets.push_back(axis.step_pin);
+        config.offsets.push_back(axis.dir_pin);
+    }
+
+    return config;
+}
+
+void StepperGroup::move(const std::vector<int> &steps, int delay_us) {
+    if (steps.size() != _axes.size()) {
+        throw std::invalid_argument("StepperGroup::move needs one step count per axis");
+    }
+
+    uint32_t period_ns;
+    if (!MotionProfile::cruisePeriodNs(delay_us, period_ns)) {
+        throw std::invalid_argument("StepperGroup::move delay_us is out of range");
+    }
+
+    GpioLines::Values directions;
+    std::vector<int> counts;
+    int ticks = 0;
+
+    for (size_t axis = 0; axis < steps.size(); axis++) {
+        directions.emplace_back(_axes[axis].dir_pin, steps[axis] >= 0);
+        counts.push_back(std::abs(steps[axis]));
+        ticks = std::max(ticks, std::abs(steps[axis]));
+    }
+
+    _lines->setValues(directions);
+    _backend.sleepUntilNs(_backend.nowNs() + 10000);
+
+    MotionProfile profile(period_ns, _acceleration, _ramp_shape);
+
+    std::vector<uint64_t> edges;
+    edges.reserve(ticks * 2);
+
+    uint64_t edge_time_ns = 0;
+    for (int i = 0; i < ticks; ++i) {
+        uint32_t period_ns = profile.periodNs(i, ticks);
+
+        edges.push_back(edge_time_ns);
+        edges.push_back(edge_time_ns + period_ns / 2);
+        edge_time_ns += period_ns;
+    }
+
+    // Bresenham: an axis steps on a tick once its accumulated share reaches a full tick
+    std::vector<int> error(_axes.size(), 0);
+    GpioLines::Values rising;
+    GpioLines::Values falling;
+
+    for (const Axis &axis : _axes) {
+        rising.emplace_back(axis.step_pin, false);
+        falling.emplace_back(axis.step_pin, false);
+    }
+
+    uint64_t last_rise_ns = 0;
+
+    _last_move_stats = _engine.run(std::move(edges), [&](size_t edge) {
+        uint64_t start = Utils::monotonicNs();
+
+        if (edge % 2 == 1) {
+            _lines->setValues(falling);
+            Metrics::recordSince(Metrics::Op::STEP_SET_VALUE, start);
+            return;
+        }
+
+        for (size_t axis = 0; axis < counts.size(); axis++) {
+            error[axis] += counts[axis];
+
+            if (error[axis] >= ticks) {
+                error[axis] -= ticks;
+                rising[axis].second = true;
+            } else {
+                rising[axis].second = false;
+            }
+        }
+
+        _lines->setValues(rising);
+        Metrics::recordSince(Metrics::Op::STEP_SET_VALUE, start);
+
+        uint64_t rise_ns = _backend.nowNs();
+        if (last_rise_ns) {
+            Metrics::record(Metrics::Op::STEP_PERIOD, rise_ns - last_rise_ns);
+        }
+        last_rise_ns = rise_ns;
+    });
+}
+
+void StepperGroup::setAcceleration(uint32_t steps_per_s2, MotionProfile::Shape shape) {
+    _acceleration = steps_per_s2;
+    _ramp_shape = shape;
+}
+
+void StepperGroup::setBusyWait(microseconds window) {
+    _engine.setSpinWindow(window);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#include "GpioBackend.h"
+#include "StepPulseEngine.h"
+#include "MotionProfile.h"
+
+// Several step/dir axes held in one line request and moved together. Every tick
+// writes all step lines with a single setValues call, with the axes interpolated
+// against the one that has the most steps to go.
+class StepperGroup {
+    public:
+        struct Axis {
+            unsigned int step_pin;
+            unsigned int dir_pin;
+        };
+
+        StepperGroup(const std::vector<Axis> &axes, const std::string &chip_path,
+                     GpioBackend &backend = GpioBackend::defaultBackend());
+
+        // Signed step count per axis, positive is clockwise. delay_us paces the longest axis.
+        // Throws std::invalid_argument for a delay_us outside 0..MotionProfile::MAX_DELAY_US
+        void move(const std::vector<int> &steps, int delay_us);
+
+        void setAcceleration(uint32_t steps_per_s2, MotionProfile::Shape shape = MotionProfile::Shape::TRAPEZOIDAL);
+        void setBusyWait(std::chrono::microseconds window);
+        StepPulseEngine::Stats getLastMoveStats() const { return _last_move_stats; }
+
+        size_t size() const { return _axes.size(); }
+
+    private:
+        GpioBackend &_backend;
+        std::vector<Axis> _axes;
+        std::unique_ptr<GpioLines> _lines;
+
+        uint32_t _acceleration = 0;
+        MotionProfile::Shape _ramp_shape = MotionProfile::Shape::TRAPEZOIDAL;
+
+        StepPulseEngine _engine;
+        StepPulseEngine::Stats _last_move_stats;
+
+        static GpioBackend::LineConfig lineConfig(const std::vector<Axis> &axes);
+};
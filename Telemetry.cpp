@@ -0,0 +1,347 @@
+#include "Telemetry.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Controller.h"
+#include "Log.h"
+#include "MagnetBank.h"
+#include "MagnetController.h"
+#include "MotorBus.h"
+#include "MotorController.h"
+#include "StepperController.h"
+#include "Utils.h"
+
+namespace Telemetry {
+    static const char TELEMETRY_MAGIC[8] = {'M', 'C', 'T', 'E', 'L', 'E', 'M', 0};
+    static const uint32_t TELEMETRY_VERSION = 1;
+
+    static const size_t COLUMN_WIDTHS[] = {8, 2, 1, 1, 4, 4};
+    static const char *const KIND_NAMES[] = {
+        "motor_sample", "motor_error", "stepper_move", "stepper_stop", "stepper_abort",
+        "stepper_enable", "magnet_set", "servo_speed", "dropped"
+    };
+    static const char *const DEVICE_NAMES[] = {"motor", "stepper", "magnet", "servo", "recorder"};
+
+    // Columns start on their own pages so each one is contiguous for readers
+    static constexpr size_t COLUMN_ALIGNMENT = 4096;
+
+    static Ring ring;
+    static std::atomic<bool> recording{false};
+    static std::atomic<uint64_t> dropped{0};
+
+    size_t columnWidth(Column column) {
+        return COLUMN_WIDTHS[(size_t)column];
+    }
+
+    static size_t alignUp(size_t value) {
+        return (value + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT;
+    }
+
+    size_t layout(uint64_t capacity, Header *header) {
+        size_t offset = alignUp(sizeof(Header));
+
+        for (size_t column = 0; column < (size_t)Column::COUNT; column++) {
+            if (header) {
+                header->column_offsets[column] = offset;
+            }
+            offset = alignUp(offset + capacity * COLUMN_WIDTHS[column]);
+        }
+
+        return offset;
+    }
+
+    bool valid(const Header &header, size_t size) {
+        if (size < sizeof(Header) || memcmp(header.magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC)) != 0 ||
+            header.version != TELEMETRY_VERSION || header.capacity == 0 || header.source_count > MAX_SOURCES) {
+            return false;
+        }
+
+        Header expected;
+        if (layout(header.capacity, &expected) != size) {
+            return false;
+        }
+
+        return memcmp(expected.column_offsets, header.column_offsets, sizeof(expected.column_offsets)) == 0;
+    }
+
+    const char *kindName(Kind kind) {
+        return (size_t)kind < std::size(KIND_NAMES) ? KIND_NAMES[(size_t)kind] : "unknown";
+    }
+
+    const char *deviceName(Device device) {
+        return (size_t)device < std::size(DEVICE_NAMES) ? DEVICE_NAMES[(size_t)device] : "unknown";
+    }
+
+    void record(Source source, Kind kind, int32_t a, int32_t b, uint8_t flags) {
+        if (source == NO_SOURCE || !recording.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        uint64_t now = Utils::monotonicNs();
+        bool queued = ring.tryPush([&](Row &row) {
+            row = {now, a, b, source, kind, flags};
+        });
+
+        if (!queued) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename T>
+    static T *column(Header *header, Column column) {
+        return reinterpret_cast<T *>(reinterpret_cast<char *>(header) + header->column_offsets[(size_t)column]);
+    }
+
+    Recorder::Recorder() = default;
+
+    Recorder::~Recorder() {
+        stop();
+        unmap();
+    }
+
+    void Recorder::unmap() {
+        if (_header) {
+            munmap(_header, _size);
+            _header = nullptr;
+        }
+    }
+
+    bool Recorder::open(const std::string &path, const Config &config) {
+        if (_thread.joinable()) {
+            Log::error("Telemetry is already recording");
+            return false;
+        } else if (config.capacity == 0 || config.sample_period.count() <= 0) {
+            Log::error("Telemetry needs a capacity and a sample period");
+            return false;
+        }
+
+        unmap();
+        _motors.clear();
+
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        size_t size = layout(config.capacity);
+
+        if (fd == -1 || ftruncate(fd, size) == -1) {
+            Log::error("Couldn't create the telemetry file ", path, ": ", strerror(errno));
+            if (fd != -1) {
+                close(fd);
+            }
+            return false;
+        }
+
+        void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (data == MAP_FAILED) {
+            Log::error("Couldn't map the telemetry file ", path, ": ", strerror(errno));
+            return false;
+        }
+
+        _header = static_cast<Header *>(data);
+        _size = size;
+
+        memcpy(_header->magic, TELEMETRY_MAGIC, sizeof(TELEMETRY_MAGIC));
+        _header->version = TELEMETRY_VERSION;
+        _header->capacity = config.capacity;
+        _header->sample_period_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(config.sample_period).count();
+        layout(config.capacity, _header);
+        _header->rows.store(0, std::memory_order_relaxed);
+        _header->writing.store(0, std::memory_order_relaxed);
+
+        _self = addSource("recorder", Device::RECORDER);
+        return true;
+    }
+
+    Source Recorder::addSource(const std::string &name, Device device) {
+        if (!_header) {
+            Log::error("Telemetry file isn't open");
+            return NO_SOURCE;
+        } else if (_thread.joinable()) {
+            Log::error("Telemetry sources must be added before recording starts");
+            return NO_SOURCE;
+        } else if (_header->source_count == MAX_SOURCES) {
+            Log::error("Telemetry can't record more than ", MAX_SOURCES, " sources");
+            return NO_SOURCE;
+        }
+
+        SourceInfo &source = _header->sources[_header->source_count];
+        memset(&source, 0, sizeof(source));
+        strncpy(source.name, name.c_str(), SOURCE_NAME_SIZE - 1);
+        source.device = device;
+
+        return _header->source_count++;
+    }
+
+    bool Recorder::add(const std::string &name, MotorController &motor) {
+        Source source = addSource(name, Device::MOTOR);
+        if (source == NO_SOURCE) {
+            return false;
+        }
+
+        auto link = std::make_unique<MotorController>(motor.getProfilePath(), motor.getIpAddress(), motor.getPort(), motor.getSlaveId());
+        _motors.push_back({source, std::move(link)});
+        return true;
+    }
+
+    bool Recorder::add(const std::string &name, StepperController &stepper) {
+        Source source = addSource(name, Device::STEPPER);
+        stepper.setTelemetrySource(source);
+        return source != NO_SOURCE;
+    }
+
+    bool Recorder::add(const std::string &name, MagnetController &magnet) {
+        Source source = addSource(name, Device::MAGNET);
+        magnet.setTelemetrySource(source);
+        return source != NO_SOURCE;
+    }
+
+    bool Recorder::add(const std::string &name, MagnetBank &magnets) {
+        Source source = addSource(name, Device::MAGNET);
+        magnets.setTelemetrySource(source);
+        return source != NO_SOURCE;
+    }
+
+    bool Recorder::add(const std::string &name, Controller &servo) {
+        Source source = addSource(name, Device::SERVO);
+        servo.setTelemetrySource(source);
+        return source != NO_SOURCE;
+    }
+
+    bool Recorder::start() {
+        if (!_header) {
+            Log::error("Telemetry file isn't open");
+            return false;
+        } else if (_thread.joinable() || recording.exchange(true)) {
+            Log::error("Telemetry is already recording");
+            return false;
+        }
+
+        // Commands left over from an earlier recording belong to it
+        while (ring.tryPop([](const Row &) {})) {}
+        dropped = 0;
+
+        timespec realtime;
+        clock_gettime(CLOCK_REALTIME, &realtime);
+        _header->start_ns = Utils::monotonicNs();
+        _header->start_realtime_ns = (int64_t)realtime.tv_sec * 1000000000 + realtime.tv_nsec;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = false;
+        }
+
+        _thread = std::thread(&Recorder::loop, this);
+        return true;
+    }
+
+    void Recorder::stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _cv.notify_all();
+
+        if (_thread.joinable()) {
+            _thread.join();
+            recording = false;
+        }
+    }
+
+    uint64_t Recorder::rows() const {
+        return _header ? _header->rows.load(std::memory_order_acquire) : 0;
+    }
+
+    void Recorder::append(const Row &row) {
+        uint64_t count = _header->rows.load(std::memory_order_relaxed);
+        uint64_t index = count % _header->capacity;
+
+        // Readers copying the row being overwritten see writing move past it and discard their copy
+        _header->writing.store(count + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        column<uint64_t>(_header, Column::TIME)[index] = row.time_ns;
+        column<uint16_t>(_header, Column::SOURCE)[index] = row.source;
+        column<uint8_t>(_header, Column::KIND)[index] = (uint8_t)row.kind;
+        column<uint8_t>(_header, Column::FLAGS)[index] = row.flags;
+        column<int32_t>(_header, Column::A)[index] = row.a;
+        column<int32_t>(_header, Column::B)[index] = row.b;
+
+        _header->rows.store(count + 1, std::memory_order_release);
+    }
+
+    void Recorder::drain() {
+        while (ring.tryPop([this](const Row &row) { append(row); })) {}
+
+        uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+        if (lost > 0) {
+            append({Utils::monotonicNs(), (int32_t)std::min<uint64_t>(lost, INT32_MAX), 0, _self, Kind::DROPPED, 0});
+        }
+    }
+
+    void Recorder::sample() {
+        for (const Motor &motor : _motors) {
+            Source source = motor.source;
+
+            // Adding again picks up the socket the link's supervisor reconnected with
+            bool submitted = _bus->add(*motor.link) &&
+                _bus->submitSnapshot(*motor.link, [this, source](bool ok, const MotorController::MotorState &state) {
+                    if (ok) {
+                        append({Utils::monotonicNs(), state.position, state.velocity, source, Kind::MOTOR_SAMPLE, state.moving});
+                    } else {
+                        append({Utils::monotonicNs(), 0, 0, source, Kind::MOTOR_ERROR, 0});
+                    }
+                });
+
+            if (!submitted) {
+                append({Utils::monotonicNs(), 0, 0, source, Kind::MOTOR_ERROR, 0});
+            }
+        }
+
+        // Every motor is read at once, a slow drive only costs its own row
+        _bus->run();
+    }
+
+    void Recorder::loop() {
+        using namespace std::chrono;
+
+        const uint64_t period_ns = _header->sample_period_ns;
+
+        // A sample gives up on a drive after one period
+        _bus = std::make_unique<MotorBus>(std::max(ceil<milliseconds>(nanoseconds(period_ns)), milliseconds(1)));
+        for (const Motor &motor : _motors) {
+            if (!motor.link->isConnected() && !motor.link->connect()) {
+                Log::warning("Telemetry couldn't connect to ", motor.link->getIpAddress(), ", its samples will be errors");
+            }
+        }
+
+        uint64_t next_ns = Utils::monotonicNs();
+
+        while (true) {
+            drain();
+            sample();
+
+            next_ns += period_ns;
+
+            // After a stall, carry on from now rather than sampling a burst of late periods
+            uint64_t now = Utils::monotonicNs();
+            if (now > next_ns + period_ns) {
+                next_ns = now;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_cv.wait_until(lock, steady_clock::time_point(nanoseconds(next_ns)), [this] { return _stopping; })) {
+                break;
+            }
+        }
+
+        drain();
+        _bus.reset();
+    }
+}
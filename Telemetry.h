@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "MpscRing.h"
+
+class MotorController;
+class MotorBus;
+class StepperController;
+class MagnetController;
+class MagnetBank;
+class Controller;
+
+// Flight recorder for shows. Motors are sampled at a fixed rate and device commands are
+// logged as they are issued, all into a ring of rows in a memory-mapped file that survives
+// the process. Control threads only push a row onto a lock-free ring and return; the
+// recorder thread does the sampling and the file writes. Motors are sampled over connections
+// of the recorder's own, through a MotorBus, so a sample never holds up a control call.
+//
+// The file is a header followed by one fixed-width column per field, each `capacity` rows
+// long. Row r lives at index r % capacity and header.rows counts every row ever written, so
+// the newest capacity rows are always on disk. tools/telemetry_export.cpp reads it back.
+namespace Telemetry {
+    enum class Kind : uint8_t {
+        MOTOR_SAMPLE, // a position, b velocity, flags moving
+        MOTOR_ERROR, // The sample couldn't be read
+        STEPPER_MOVE, // a signed steps (negative is counter-clockwise), b delay_us
+        STEPPER_STOP,
+        STEPPER_ABORT,
+        STEPPER_ENABLE, // a on/off
+        MAGNET_SET, // a on/off, b the magnet's index in a MagnetBank
+        SERVO_SPEED, // a percent, b pulse width in us
+        DROPPED // a rows lost because the command ring was full
+    };
+
+    enum class Device : uint8_t {
+        MOTOR,
+        STEPPER,
+        MAGNET,
+        SERVO,
+        RECORDER
+    };
+
+    enum class Column {
+        TIME, // uint64_t CLOCK_MONOTONIC ns
+        SOURCE, // uint16_t index into Header::sources
+        KIND, // uint8_t Kind
+        FLAGS, // uint8_t
+        A, // int32_t
+        B, // int32_t
+        COUNT
+    };
+
+    using Source = uint16_t;
+    constexpr Source NO_SOURCE = UINT16_MAX;
+
+    constexpr size_t SOURCE_NAME_SIZE = 32;
+    constexpr size_t MAX_SOURCES = 256;
+    constexpr size_t COMMAND_RING_CAPACITY = 4096;
+
+    struct Row {
+        uint64_t time_ns;
+        int32_t a;
+        int32_t b;
+        Source source;
+        Kind kind;
+        uint8_t flags;
+    };
+
+    struct SourceInfo {
+        char name[SOURCE_NAME_SIZE];
+        Device device;
+        uint8_t reserved[7];
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "The row count is shared through the file");
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t source_count;
+        uint64_t capacity;
+        uint64_t sample_period_ns;
+        uint64_t start_ns; // CLOCK_MONOTONIC when recording started
+        int64_t start_realtime_ns; // CLOCK_REALTIME at the same moment
+        uint64_t column_offsets[(size_t)Column::COUNT];
+        std::atomic<uint64_t> rows; // Stored after the row it counts is complete
+        std::atomic<uint64_t> writing; // Stored before a row is overwritten, rows + 1 while one is
+        SourceInfo sources[MAX_SOURCES];
+    };
+
+    struct Config {
+        std::chrono::microseconds sample_period{10000};
+        uint64_t capacity = 1 << 20; // Rows, about 20 bytes each
+    };
+
+    size_t columnWidth(Column column);
+    // Size of a file holding capacity rows, with its column offsets filled into header if given
+    size_t layout(uint64_t capacity, Header *header = nullptr);
+    // Checks the magic, version and layout of a mapped file of size bytes
+    bool valid(const Header &header, size_t size);
+
+    const char *kindName(Kind kind);
+    const char *deviceName(Device device);
+
+    // Called by the devices, from any thread. Never blocks or allocates; ignored when the
+    // source is NO_SOURCE or nothing is recording
+    void record(Source source, Kind kind, int32_t a = 0, int32_t b = 0, uint8_t flags = 0);
+
+    using Ring = MpscRing<Row, COMMAND_RING_CAPACITY>;
+
+    // Only one recorder can be started at a time
+    class Recorder {
+        public:
+            Recorder();
+            ~Recorder();
+
+            Recorder(const Recorder&) = delete;
+            Recorder& operator=(const Recorder&) = delete;
+
+            // Creates or truncates path and maps it
+            bool open(const std::string &path, const Config &config);
+
+            // Before start(). Motors are read through a second connection to the same drive, so
+            // the drive has to accept two; the others tag their commands and can go at any time
+            bool add(const std::string &name, MotorController &motor);
+            bool add(const std::string &name, StepperController &stepper);
+            bool add(const std::string &name, MagnetController &magnet);
+            bool add(const std::string &name, MagnetBank &magnets);
+            bool add(const std::string &name, Controller &servo);
+
+            bool start();
+            void stop();
+
+            uint64_t rows() const;
+
+        private:
+            Header *_header = nullptr;
+            size_t _size = 0;
+            Source _self = NO_SOURCE;
+
+            struct Motor {
+                Source source;
+                std::unique_ptr<MotorController> link; // The recorder's own connection to the drive
+            };
+
+            std::vector<Motor> _motors;
+            std::unique_ptr<MotorBus> _bus;
+
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            bool _stopping = false;
+            std::thread _thread;
+
+            Source addSource(const std::string &name, Device device);
+            void append(const Row &row);
+            void drain();
+            void sample();
+            void loop();
+            void unmap();
+    };
+}
@@ -0,0 +1,358 @@
+#include "Timeline.h"
+#include "MotionProfile.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char TIMELINE_MAGIC[8] = {'M', 'C', 'S', 'H', 'O', 'W', 0, 0};
+static const uint32_t TIMELINE_VERSION = 1;
+
+struct ActionSpec {
+    Timeline::ChannelKind kind;
+    const char *name;
+    Timeline::Action action;
+    int arg_count;
+    bool on_off; // Arguments are on/off rather than integers
+};
+
+static const ActionSpec ACTIONS[] = {
+    {Timeline::ChannelKind::MOTOR, "position", Timeline::Action::MOTOR_POSITION, 1, false},
+    {Timeline::ChannelKind::MOTOR, "initial-velocity", Timeline::Action::MOTOR_INITIAL_VELOCITY, 1, false},
+    {Timeline::ChannelKind::MOTOR, "max-velocity", Timeline::Action::MOTOR_MAX_VELOCITY, 1, false},
+    {Timeline::ChannelKind::STEPPER, "move", Timeline::Action::STEPPER_MOVE, 2, false},
+    {Timeline::ChannelKind::STEPPER, "enable", Timeline::Action::STEPPER_ENABLE, 1, true},
+    {Timeline::ChannelKind::MAGNET, "set", Timeline::Action::MAGNET_SET, 1, true},
+    {Timeline::ChannelKind::SERVO, "speed", Timeline::Action::SERVO_SPEED, 1, false},
+    {Timeline::ChannelKind::SERVO, "stop", Timeline::Action::SERVO_STOP, 0, false},
+};
+
+static const char *const KIND_NAMES[] = {"motor", "stepper", "magnet", "servo"};
+
+static std::string_view trim(std::string_view text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string_view::npos) {
+        return std::string_view();
+    }
+
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+// Splits off the next whitespace separated token
+static std::string_view nextToken(std::string_view &text) {
+    text = trim(text);
+    size_t end = std::min(text.find_first_of(" \t"), text.size());
+
+    std::string_view token = text.substr(0, end);
+    text.remove_prefix(end);
+    return token;
+}
+
+static bool parseInt(std::string_view text, int32_t &value) {
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    return !text.empty() && result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+static bool fileVersion(const std::string &path, uint64_t &size, int64_t &mtime_ns) {
+    struct stat info;
+
+    if (stat(path.c_str(), &info) == -1) {
+        return false;
+    }
+
+    size = info.st_size;
+    mtime_ns = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+const char *Timeline::kindName(ChannelKind kind) {
+    return KIND_NAMES[(size_t)kind];
+}
+
+Timeline::ChannelKind Timeline::actionKind(Action action) {
+    for (const ActionSpec &spec : ACTIONS) {
+        if (spec.action == action) {
+            return spec.kind;
+        }
+    }
+
+    return ChannelKind::MOTOR;
+}
+
+bool Timeline::compile(const std::string &source_path, const std::string &binary_path, std::string &error) {
+    FILE *source = fopen(source_path.c_str(), "rb");
+    if (!source) {
+        error = "Couldn't open the show file " + source_path;
+        return false;
+    }
+
+    std::string text;
+    char buffer[4096];
+    for (size_t read; (read = fread(buffer, 1, sizeof(buffer), source)) > 0;) {
+        text.append(buffer, read);
+    }
+    fclose(source);
+
+    Header header = {};
+    memcpy(header.magic, TIMELINE_MAGIC, sizeof(TIMELINE_MAGIC));
+    header.version = TIMELINE_VERSION;
+
+    if (!fileVersion(source_path, header.source_size, header.source_mtime_ns)) {
+        error = "Couldn't stat the show file " + source_path;
+        return false;
+    }
+
+    std::vector<Channel> channels;
+    std::vector<Cue> cues;
+    std::string_view table;
+    size_t line_number = 0;
+
+    auto fail = [&](const std::string &message) {
+        error = source_path + ":" + std::to_string(line_number) + ": " + message;
+        return false;
+    };
+
+    std::string_view remaining(text);
+    while (!remaining.empty()) {
+        size_t end = std::min(remaining.find('\n'), remaining.size());
+        std::string_view line = remaining.substr(0, end);
+        remaining.remove_prefix(std::min(end + 1, remaining.size()));
+        line_number++;
+
+        line = trim(line.substr(0, line.find('#')));
+
+        if (line.empty()) {
+            continue;
+        }
+
+        if (line.front() == '[') {
+            if (line.back() != ']') {
+                return fail("unterminated table header");
+            }
+
+            table = trim(line.substr(1, line.size() - 2));
+            if (table != "channels" && table != "cues") {
+                return fail("unknown table " + std::string(table));
+            }
+            continue;
+        }
+
+        if (table == "channels") {
+            size_t equals = line.find('=');
+            if (equals == std::string_view::npos) {
+                return fail("expected name = kind");
+            }
+
+            std::string_view name = trim(line.substr(0, equals));
+            std::string_view kind = trim(line.substr(equals + 1));
+
+            if (name.empty() || name.size() >= CHANNEL_NAME_SIZE) {
+                return fail("channel names must be 1 to " + std::to_string(CHANNEL_NAME_SIZE - 1) + " characters");
+            }
+
+            for (const Channel &channel : channels) {
+                if (name == channel.name) {
+                    return fail("channel " + std::string(name) + " declared twice");
+                }
+            }
+
+            auto kind_name = std::find(std::begin(KIND_NAMES), std::end(KIND_NAMES), kind);
+            if (kind_name == std::end(KIND_NAMES)) {
+                return fail("unknown channel kind " + std::string(kind));
+            }
+
+            if (channels.size() == UINT16_MAX) {
+                return fail("too many channels");
+            }
+
+            Channel channel = {};
+            memcpy(channel.name, name.data(), name.size());
+            channel.kind = (ChannelKind)(kind_name - std::begin(KIND_NAMES));
+            channels.push_back(channel);
+        } else if (table == "cues") {
+            std::string_view time = nextToken(line);
+            std::string_view name = nextToken(line);
+            std::string_view action = nextToken(line);
+
+            double seconds = 0;
+            auto result = std::from_chars(time.data(), time.data() + time.size(), seconds);
+            if (result.ec != std::errc() || result.ptr != time.data() + time.size() || !(seconds >= 0)) {
+                return fail("invalid cue time " + std::string(time));
+            }
+
+            auto channel = std::find_if(channels.begin(), channels.end(), [&](const Channel &candidate) {
+                return name == candidate.name;
+            });
+            if (channel == channels.end()) {
+                return fail("undeclared channel " + std::string(name));
+            }
+
+            const ActionSpec *spec = nullptr;
+            for (const ActionSpec &candidate : ACTIONS) {
+                if (candidate.kind == channel->kind && action == candidate.name) {
+                    spec = &candidate;
+                    break;
+                }
+            }
+            if (!spec) {
+                return fail(std::string(kindName(channel->kind)) + " channels have no action " + std::string(action));
+            }
+
+            Cue cue = {};
+            cue.time_ns = (uint64_t)std::llround(seconds * 1e9);
+            cue.channel = channel - channels.begin();
+            cue.action = spec->action;
+
+            for (int i = 0; i < spec->arg_count; i++) {
+                std::string_view argument = nextToken(line);
+
+                if (spec->on_off && (argument == "on" || argument == "off")) {
+                    cue.args[i] = argument == "on";
+                } else if (spec->on_off || !parseInt(argument, cue.args[i])) {
+                    return fail("invalid argument " + std::string(argument) + " for " + spec->name);
+                }
+            }
+
+            if (!trim(line).empty()) {
+                return fail(std::string("too many arguments for ") + spec->name);
+            } else if (spec->action == Action::STEPPER_MOVE && cue.args[1] < 1) {
+                return fail("step delay must be at least 1us");
+            } else if (spec->action == Action::STEPPER_MOVE && cue.args[1] > MotionProfile::MAX_DELAY_US) {
+                return fail("step delay must be at most " + std::to_string(MotionProfile::MAX_DELAY_US) + "us");
+            } else if (spec->action == Action::SERVO_SPEED && (cue.args[0] < -100 || cue.args[0] > 100)) {
+                return fail("servo speed must be between -100 and 100");
+            }
+
+            cues.push_back(cue);
+        } else {
+            return fail("expected a [channels] or [cues] table");
+        }
+    }
+
+    std::stable_sort(cues.begin(), cues.end(), [](const Cue &a, const Cue &b) {
+        return a.time_ns < b.time_ns;
+    });
+
+    header.channel_count = channels.size();
+    header.cue_count = cues.size();
+
+    // Written aside and renamed so a concurrent reader never maps half a file
+    std::string temporary = binary_path + "." + std::to_string(getpid());
+    FILE *binary = fopen(temporary.c_str(), "wb");
+    if (!binary) {
+        error = "Couldn't write " + temporary;
+        return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, binary) == 1 &&
+                   fwrite(channels.data(), sizeof(Channel), channels.size(), binary) == channels.size() &&
+                   fwrite(cues.data(), sizeof(Cue), cues.size(), binary) == cues.size();
+    written = fclose(binary) == 0 && written;
+
+    if (!written || rename(temporary.c_str(), binary_path.c_str()) != 0) {
+        unlink(temporary.c_str());
+        error = "Couldn't write " + binary_path;
+        return false;
+    }
+
+    return true;
+}
+
+std::unique_ptr<Timeline> Timeline::open(const std::string &binary_path, std::string &error) {
+    int fd = ::open(binary_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+
+    if (fd == -1 || fstat(fd, &info) == -1 || (size_t)info.st_size < sizeof(Header)) {
+        error = "Couldn't open the compiled show " + binary_path;
+        if (fd != -1) {
+            close(fd);
+        }
+        return nullptr;
+    }
+
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        error = "Couldn't map the compiled show " + binary_path;
+        return nullptr;
+    }
+
+    std::unique_ptr<Timeline> timeline(new Timeline());
+    timeline->_data = data;
+    timeline->_size = info.st_size;
+    timeline->_header = static_cast<const Header *>(data);
+
+    const Header &header = *timeline->_header;
+    size_t expected_size = sizeof(Header) + header.channel_count * sizeof(Channel) + (size_t)header.cue_count * sizeof(Cue);
+
+    if (memcmp(header.magic, TIMELINE_MAGIC, sizeof(TIMELINE_MAGIC)) != 0 || header.version != TIMELINE_VERSION ||
+        expected_size != timeline->_size) {
+        error = binary_path + " is not a compiled show of this version";
+        return nullptr;
+    }
+
+    timeline->_channels = reinterpret_cast<const Channel *>(timeline->_header + 1);
+    timeline->_cues = reinterpret_cast<const Cue *>(timeline->_channels + header.channel_count);
+
+    for (size_t i = 0; i < header.cue_count; i++) {
+        const Cue &cue = timeline->_cues[i];
+
+        if (cue.channel >= header.channel_count || cue.action > Action::SERVO_STOP ||
+            actionKind(cue.action) != timeline->_channels[cue.channel].kind) {
+            error = binary_path + " is corrupt";
+            return nullptr;
+        }
+    }
+
+    return timeline;
+}
+
+std::unique_ptr<Timeline> Timeline::load(const std::string &path, std::string &error) {
+    uint64_t size;
+    int64_t mtime_ns;
+
+    if (!fileVersion(path, size, mtime_ns)) {
+        error = "Couldn't open the show file " + path;
+        return nullptr;
+    }
+
+    std::string binary_path = path + ".bin";
+    std::unique_ptr<Timeline> timeline = open(binary_path, error);
+
+    if (timeline && timeline->_header->source_size == size && timeline->_header->source_mtime_ns == mtime_ns) {
+        return timeline;
+    }
+
+    error.clear();
+    if (!compile(path, binary_path, error)) {
+        return nullptr;
+    }
+
+    return open(binary_path, error);
+}
+
+Timeline::~Timeline() {
+    if (_data) {
+        munmap(_data, _size);
+    }
+}
+
+int Timeline::findChannel(const std::string &name) const {
+    for (size_t i = 0; i < channelCount(); i++) {
+        if (name == _channels[i].name) {
+            return i;
+        }
+    }
+
+    return -1;
+}
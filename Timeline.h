@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// A show: timestamped cues for named device channels, compiled from text into a flat
+// binary that is memory-mapped for playback (see ShowPlayer).
+//
+//     [channels]
+//     lift = motor        # MotorController
+//     arm = stepper       # StepperController
+//     door = magnet       # MagnetController
+//     fan = servo         # Controller
+//
+//     [cues]
+//     # seconds  channel  action            arguments
+//     0.0        lift     max-velocity      50000
+//     0.0        lift     position          12000
+//     1.5        door     set               on
+//     2.0        arm      move              -800 500    # steps (sign is direction), delay_us
+//     2.0        arm      enable            off
+//     2.25       fan      speed             40
+//     6.0        fan      stop
+//
+// The compiled copy is written next to the source (<show>.bin) and reused until the source changes.
+class Timeline {
+    public:
+        enum class ChannelKind : uint8_t {
+            MOTOR,
+            STEPPER,
+            MAGNET,
+            SERVO
+        };
+
+        enum class Action : uint8_t {
+            MOTOR_POSITION,
+            MOTOR_INITIAL_VELOCITY,
+            MOTOR_MAX_VELOCITY,
+            STEPPER_MOVE,
+            STEPPER_ENABLE,
+            MAGNET_SET,
+            SERVO_SPEED,
+            SERVO_STOP
+        };
+
+        static constexpr size_t CHANNEL_NAME_SIZE = 32;
+
+        struct Channel {
+            char name[CHANNEL_NAME_SIZE];
+            ChannelKind kind;
+            uint8_t reserved[7];
+        };
+
+        struct Cue {
+            uint64_t time_ns;
+            uint16_t channel;
+            Action action;
+            uint8_t reserved;
+            int32_t args[2];
+        };
+
+        struct Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t channel_count;
+            uint32_t cue_count;
+            uint32_t reserved;
+            uint64_t source_size;
+            int64_t source_mtime_ns;
+        };
+
+        // Compiles path if its binary is missing or stale, then maps the binary. nullptr and error on failure
+        static std::unique_ptr<Timeline> load(const std::string &path, std::string &error);
+        static bool compile(const std::string &source_path, const std::string &binary_path, std::string &error);
+        static std::unique_ptr<Timeline> open(const std::string &binary_path, std::string &error);
+
+        ~Timeline();
+
+        Timeline(const Timeline&) = delete;
+        Timeline& operator=(const Timeline&) = delete;
+
+        size_t channelCount() const { return _header->channel_count; }
+        const Channel &channel(size_t index) const { return _channels[index]; }
+        // -1 if there is no such channel
+        int findChannel(const std::string &name) const;
+
+        // Ordered by time, cues at the same time keep their order in the source
+        size_t cueCount() const { return _header->cue_count; }
+        const Cue &cue(size_t index) const { return _cues[index]; }
+
+        uint64_t durationNs() const { return cueCount() ? _cues[cueCount() - 1].time_ns : 0; }
+
+        static const char *kindName(ChannelKind kind);
+        static ChannelKind actionKind(Action action);
+
+    private:
+        Timeline() = default;
+
+        void *_data = nullptr;
+        size_t _size = 0;
+
+        const Header *_header = nullptr;
+        const Channel *_channels = nullptr;
+        const Cue *_cues = nullptr;
+};
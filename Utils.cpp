@@ -1,4 +1,8 @@
 #include "Utils.h"
+#include "Metrics.h"
+
+#include <errno.h>
+#include <time.h>
 
 namespace Utils {
     double lerp(double current, double target, double t) {
@@ -8,4 +12,21 @@ namespace Utils {
     short getBit(short value, short bit) {
         return (value & ( bit << bit )) >> bit;
     }
+
+    uint64_t monotonicNs() {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+    }
+
+    void sleepUntilNs(uint64_t deadline_ns) {
+        timespec deadline;
+        deadline.tv_sec = deadline_ns / 1000000000ull;
+        deadline.tv_nsec = deadline_ns % 1000000000ull;
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, nullptr) == EINTR) {}
+
+        uint64_t now = monotonicNs();
+        Metrics::record(Metrics::Op::WAKEUP_LATENCY, now > deadline_ns ? now - deadline_ns : 0);
+    }
 }
\ No newline at end of file
@@ -1,6 +1,12 @@
 #pragma once
 
+#include <cstdint>
+
 namespace Utils {
     double lerp(double current, double target, double t);
     short getBit(short value, short bit);
+
+    // CLOCK_MONOTONIC in nanoseconds, and an absolute sleep against it
+    uint64_t monotonicNs();
+    void sleepUntilNs(uint64_t deadline_ns);
 }
@@ -0,0 +1,428 @@
+// Micro and macro benchmarks for the motor, stepper and PWM hot paths.
+//
+//   make bench                      runs everything and writes build/bench.json
+//   ./build/bench.out out.json      same, writing to out.json
+//
+// The Modbus benchmarks run against a libmodbus TCP server started in-process on
+// 127.0.0.1. The stepper and PWM benchmarks drive a GpioSimulator unless BENCH_GPIO_CHIP
+// names a chip with at least 8 lines, normally a gpio-sim one (for example /dev/gpiochip2);
+// gpio_backend says which was used. On the simulator they time the host side only: steppers
+// run on a free-running clock, and the servo's clock is stepped in real time, so its pulse
+// errors show how far the scheduler thread trails the clock. stepper_sim_100k always runs on
+// a GpioSimulator and times a long move's host overhead with no real waiting.
+//
+// BENCH_REALTIME=<cpu> runs the timing threads SCHED_FIFO pinned to that core (-1 for no
+// pinning); compare metrics.wakeup_latency with and without it. Sharing one core, they
+// don't busy-wait, so the *_spin entries sleep like the others.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include "MotorController.h"
+#include "MotorBus.h"
+#include "MotorProfile.h"
+#include "StepperController.h"
+#include "StepPulseEngine.h"
+#include "Controller.h"
+#include "GpioSimulator.h"
+#include "Metrics.h"
+#include "RealTime.h"
+#include "Utils.h"
+
+static const char *PROFILE_PATH = "./LMD_P42.toml";
+static const int SERVER_PORT = 15502;
+static const int MODBUS_ITERATIONS = 2000;
+static const int BUS_MOTORS = 8;
+
+struct Latencies {
+    std::vector<uint64_t> samples;
+    uint64_t total_ns = 0;
+
+    void add(uint64_t ns) {
+        samples.push_back(ns);
+        total_ns += ns;
+    }
+
+    void write(std::ostream &out) {
+        std::sort(samples.begin(), samples.end());
+
+        auto at = [&](double percent) {
+            return samples.empty() ? 0 : samples[std::min(samples.size() - 1, (size_t)(percent / 100.0 * samples.size()))];
+        };
+
+        out << "{\"iterations\": " << samples.size()
+            << ", \"ops_per_sec\": " << (total_ns ? samples.size() * 1e9 / total_ns : 0)
+            << ", \"mean_ns\": " << (samples.empty() ? 0 : total_ns / samples.size())
+            << ", \"p50_ns\": " << at(50)
+            << ", \"p99_ns\": " << at(99)
+            << ", \"max_ns\": " << (samples.empty() ? 0 : samples.back())
+            << "}";
+    }
+};
+
+// s quoted as a JSON string
+static std::string jsonString(const std::string &s) {
+    std::string quoted = "\"";
+
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\r': quoted += "\\r"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    quoted += escaped;
+                } else {
+                    quoted += (char)c;
+                }
+        }
+    }
+
+    return quoted + "\"";
+}
+
+template <typename Fn>
+static Latencies measure(int iterations, Fn fn) {
+    Latencies latencies;
+
+    for (int i = 0; i < iterations; i++) {
+        uint64_t start = Utils::monotonicNs();
+        fn(i);
+        latencies.add(Utils::monotonicNs() - start);
+    }
+
+    return latencies;
+}
+
+// Single-threaded libmodbus server answering every client from one register mapping
+static void runServer(std::atomic<bool> &ready, std::atomic<bool> &running) {
+    modbus_t *ctx = modbus_new_tcp("127.0.0.1", SERVER_PORT);
+    modbus_mapping_t *mapping = modbus_mapping_new(0x100, 0x100, 0x100, 0x100);
+    int server = modbus_tcp_listen(ctx, BUS_MOTORS + 1);
+
+    ready = true;
+    if (server == -1) {
+        modbus_mapping_free(mapping);
+        modbus_free(ctx);
+        return;
+    }
+
+    std::vector<int> clients;
+    uint8_t query[MODBUS_TCP_MAX_ADU_LENGTH];
+
+    while (running) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(server, &fds);
+
+        int max_fd = server;
+        for (int client : clients) {
+            FD_SET(client, &fds);
+            max_fd = std::max(max_fd, client);
+        }
+
+        timeval timeout = {0, 100000};
+        if (select(max_fd + 1, &fds, nullptr, nullptr, &timeout) <= 0) {
+            continue;
+        }
+
+        if (FD_ISSET(server, &fds)) {
+            int listener = server;
+            int client = modbus_tcp_accept(ctx, &listener);
+            if (client != -1) {
+                clients.push_back(client);
+            }
+        }
+
+        for (auto it = clients.begin(); it != clients.end();) {
+            if (!FD_ISSET(*it, &fds)) {
+                ++it;
+                continue;
+            }
+
+            modbus_set_socket(ctx, *it);
+            int rc = modbus_receive(ctx, query);
+
+            if (rc > 0) {
+                modbus_reply(ctx, query, rc, mapping);
+                ++it;
+            } else if (rc == -1) {
+                close(*it);
+                it = clients.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    for (int client : clients) {
+        close(client);
+    }
+
+    close(server);
+    modbus_mapping_free(mapping);
+    modbus_free(ctx);
+}
+
+static void benchModbus(std::ostream &out) {
+    std::atomic<bool> ready(false);
+    std::atomic<bool> running(true);
+    std::thread server(runServer, std::ref(ready), std::ref(running));
+
+    while (!ready) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    MotorController motor(PROFILE_PATH, "127.0.0.1", SERVER_PORT);
+
+    if (!motor.connect()) {
+        out << "\"modbus\": {\"skipped\": " << jsonString("could not reach the local server") << "}";
+    } else {
+        MotorController::MotorState state;
+
+        out << "\"modbus_read_32\": ";
+        measure(MODBUS_ITERATIONS, [&](int) { motor.getCurrentPosition(); }).write(out);
+
+        out << ", \"modbus_write_32\": ";
+        measure(MODBUS_ITERATIONS, [&](int i) { motor.setAbsolutePosition(i); }).write(out);
+
+        out << ", \"modbus_snapshot\": ";
+        measure(MODBUS_ITERATIONS, [&](int) { motor.snapshot(state); }).write(out);
+
+        // Every motor gets its own connection, one bus snapshot refreshes them all
+        std::vector<std::unique_ptr<MotorController>> motors;
+        MotorBus bus;
+
+        for (int i = 0; i < BUS_MOTORS; i++) {
+            motors.push_back(std::make_unique<MotorController>(PROFILE_PATH, "127.0.0.1", SERVER_PORT));
+            if (motors.back()->connect()) {
+                bus.add(*motors.back());
+            }
+        }
+
+        std::vector<MotorController::MotorState> states;
+        out << ", \"bus_snapshot_" << BUS_MOTORS << "_motors\": ";
+        measure(MODBUS_ITERATIONS / 10, [&](int) { bus.snapshotAll(states); }).write(out);
+    }
+
+    running = false;
+    server.join();
+}
+
+static void benchProfileLoad(std::ostream &out) {
+    // Loading writes the compiled copy the second case reads
+    std::string error, warnings;
+    if (!MotorProfile::load(PROFILE_PATH, error, warnings)) {
+        out << "\"profile_parse\": {\"skipped\": " << jsonString(error) << "}";
+        return;
+    }
+
+    std::ifstream file(PROFILE_PATH, std::ios::binary);
+    std::string source((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    out << "\"profile_parse\": ";
+    measure(1000, [&](int) {
+        MotorProfile profile;
+        MotorProfile::parse(source.data(), source.size(), profile, error, warnings);
+        profile.validate(error);
+    }).write(out);
+
+    std::string compiled_path = std::string(PROFILE_PATH) + ".bin";
+
+    out << ", \"profile_read_compiled\": ";
+    measure(1000, [&](int) {
+        MotorProfile profile;
+        profile.readCompiled(compiled_path);
+        profile.validate(error);
+    }).write(out);
+
+    // Every later controller on the same file only hits the in-process cache
+    out << ", \"profile_load_cached\": ";
+    measure(1000, [](int) { MotorController motor(PROFILE_PATH, "127.0.0.1"); }).write(out);
+}
+
+static void writeEngineStats(std::ostream &out, const StepPulseEngine::Stats &stats) {
+    out << "{\"edges\": " << stats.edges
+        << ", \"mean_lateness_ns\": " << (uint64_t)stats.mean_lateness_ns
+        << ", \"jitter_ns\": " << (uint64_t)stats.jitter_ns
+        << ", \"max_lateness_ns\": " << stats.max_lateness_ns
+        << "}";
+}
+
+static void benchStepEngine(std::ostream &out) {
+    // The engine alone, at 20 kHz, shows the floor the GPIO writes add to
+    std::vector<uint64_t> edges;
+    for (int i = 0; i < 40000; i++) {
+        edges.push_back(i * 25000ull);
+    }
+
+    StepPulseEngine sleeping;
+    out << "\"step_engine_20khz\": ";
+    writeEngineStats(out, sleeping.run(edges, [](size_t) {}));
+
+    StepPulseEngine spinning(std::chrono::microseconds(20));
+    out << ", \"step_engine_20khz_spin\": ";
+    writeEngineStats(out, spinning.run(edges, [](size_t) {}));
+}
+
+static void benchSimulatedMove(std::ostream &out) {
+    GpioSimulator simulator;
+    unsigned int microstep_pins[4] = {3, 4, 5, 6};
+    StepperController stepper(0, 1, 2, microstep_pins, "sim", simulator);
+
+    uint64_t start = Utils::monotonicNs();
+    stepper.move(100000, true, 500);
+    uint64_t wall_ns = Utils::monotonicNs() - start;
+
+    // Every rising edge should land exactly one period after the last on the virtual clock
+    std::vector<GpioSimulator::RecordedEdge> edges = simulator.edges("sim", 0);
+    uint64_t rises = 0;
+    uint64_t last_rise_ns = 0;
+    int64_t max_period_error_ns = 0;
+
+    for (const GpioSimulator::RecordedEdge &edge : edges) {
+        if (!edge.active) {
+            continue;
+        }
+
+        if (rises++) {
+            int64_t error = (int64_t)(edge.time_ns - last_rise_ns) - 1000000;
+            max_period_error_ns = std::max(max_period_error_ns, error < 0 ? -error : error);
+        }
+        last_rise_ns = edge.time_ns;
+    }
+
+    out << "\"stepper_sim_100k\": {\"wall_ns\": " << wall_ns
+        << ", \"simulated_ns\": " << simulator.nowNs()
+        << ", \"rising_edges\": " << rises
+        << ", \"max_period_error_ns\": " << max_period_error_ns
+        << "}";
+}
+
+static void writePulseStats(std::ostream &out, const PwmScheduler::ChannelStats &stats) {
+    out << "{\"pulses\": " << stats.pulses
+        << ", \"mean_error_ns\": " << (int64_t)stats.mean_error_ns
+        << ", \"max_error_ns\": " << stats.max_error_ns
+        << "}";
+}
+
+static void benchStepperMoves(std::ostream &out, const std::string &chip_path, GpioBackend &backend) {
+    unsigned int microstep_pins[4] = {3, 4, 5, 6};
+    StepperController stepper(0, 1, 2, microstep_pins, chip_path, backend);
+    stepper.setBusyWait(std::chrono::microseconds(20));
+
+    out << "\"stepper_move_1khz\": ";
+    stepper.move(2000, true, 500);
+    writeEngineStats(out, stepper.getLastMoveStats());
+
+    out << ", \"stepper_move_20khz\": ";
+    stepper.move(20000, true, 25);
+    writeEngineStats(out, stepper.getLastMoveStats());
+}
+
+static void benchGpioChip(std::ostream &out, const std::string &chip_path) {
+    out << "\"gpio_backend\": " << jsonString(chip_path) << ", ";
+    benchStepperMoves(out, chip_path, GpioBackend::defaultBackend());
+
+    Controller servo;
+    if (!servo.initialize(7, chip_path.c_str())) {
+        out << ", \"pwm\": {\"skipped\": " << jsonString("could not request the servo line") << "}";
+        return;
+    }
+
+    servo.setSpeed(50);
+    std::this_thread::sleep_for(std::chrono::seconds(2));
+
+    out << ", \"pwm\": ";
+    writePulseStats(out, servo.getPulseStats());
+}
+
+static void benchGpioSimulated(std::ostream &out) {
+    out << "\"gpio_backend\": " << jsonString("simulator") << ", ";
+    {
+        GpioSimulator simulator;
+        benchStepperMoves(out, "sim", simulator);
+    }
+
+    // The scheduler never finishes, so its clock is stepped rather than free-running
+    GpioSimulator simulator(0, GpioSimulator::ClockMode::STEPPED);
+    Controller servo;
+
+    if (!servo.initialize(7, "sim", simulator)) {
+        out << ", \"pwm\": {\"skipped\": " << jsonString("could not request the servo line") << "}";
+        return;
+    }
+
+    servo.setSpeed(50);
+
+    // Two seconds of pulses, advancing the clock about as fast as real time. Steps divide the
+    // 1750 us pulse, so any error is the thread lagging rather than the step size
+    for (int i = 0; i < 40000; i++) {
+        simulator.advance(std::chrono::microseconds(50));
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    out << ", \"pwm\": ";
+    writePulseStats(out, servo.getPulseStats());
+
+    // Wakes the scheduler thread so the servo can be released
+    simulator.setClockMode(GpioSimulator::ClockMode::FREE_RUNNING);
+    servo.cleanup();
+}
+
+int main(int argc, char **argv) {
+    std::string output_path = argc > 1 ? argv[1] : "bench.json";
+    std::stringstream json;
+
+    if (const char *realtime_cpu = std::getenv("BENCH_REALTIME")) {
+        RealTime::Config config;
+        config.cpu = std::atoi(realtime_cpu);
+        RealTime::configure(config);
+    }
+
+    json << "{\"realtime\": " << (RealTime::enabled() ? "true" : "false") << ", \"benchmarks\": {";
+    benchModbus(json);
+    json << ", ";
+    benchProfileLoad(json);
+    json << ", ";
+    benchStepEngine(json);
+    json << ", ";
+    benchSimulatedMove(json);
+    json << ", ";
+    if (const char *chip_path = std::getenv("BENCH_GPIO_CHIP")) {
+        benchGpioChip(json, chip_path);
+    } else {
+        benchGpioSimulated(json);
+    }
+    json << "}, \"metrics\": ";
+    Metrics::dump(json);
+    json << "}" << std::endl;
+
+    std::ofstream output(output_path);
+    output << json.str();
+
+    if (!output) {
+        std::cerr << "Failed to write " << output_path << std::endl;
+        return 1;
+    }
+
+    std::cout << "Benchmark results written to " << output_path << std::endl;
+    return 0;
+}
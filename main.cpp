@@ -1,35 +1,54 @@
 #include "MotorController.h"
+#include "Log.h"
+#include "ProfileWatcher.h"
 #include <iostream>
-#include <unistd.h>
 
 int main() {
     MotorController motor("./LMD_P42.toml", "192.168.33.1");
 
     if (!motor.connect()) {
-        std::cerr << "Application exited due to failed connection" << std::endl;
+        Log::error("Application exited due to failed connection");
         return 1;
     }
+
+    // Edits to the profile apply without a restart
+    ProfileWatcher profile_watcher;
+    if (profile_watcher.add(motor)) {
+        profile_watcher.start();
+    }
     
     int32_t pos_1;
     int32_t pos_2 = 0;
 
+    // The prompt is not a log line, so anything still queued goes out first
+    Log::flush();
     std::cout << "Enter rotational amount: ";
     std::cin >> pos_1;
 
     if (motor.setAbsolutePosition(pos_1)) {
-        std::cout << "Successfully commanded move to " << pos_1 << std::endl << "Waiting for move to complete..." << std::endl;
-        std::cout << "Moving flag: " << motor.isMoving() << std::endl;
-        sleep(5);
-        std::cout << "Moving flag: " << motor.isMoving() << std::endl;
+        Log::info("Successfully commanded move to ", pos_1);
+        Log::info("Waiting for move to complete...");
+
+        MotorController::MoveWaitReport wait;
+        if (motor.waitForMove(std::chrono::milliseconds(60000), &wait)) {
+            Log::info("Move complete after ", wait.elapsed_ns / 1000000, "ms (predicted ", wait.predicted_ns / 1000000, "ms, ", wait.reads, " reads)");
+        } else {
+            Log::warning("Move did not complete");
+        }
     }
 
     if (motor.setAbsolutePosition(pos_2)) {
-        std::cout << "Successfully commanded move to " << pos_2 << std::endl << "Waiting for move to complete..." << std::endl;
-        std::cout << "Moving flag: " << motor.isMoving() << std::endl;
-        sleep(5);
-        std::cout << "Moving flag: " << motor.isMoving() << std::endl;
+        Log::info("Successfully commanded move to ", pos_2);
+        Log::info("Waiting for move to complete...");
+
+        MotorController::MoveWaitReport wait;
+        if (motor.waitForMove(std::chrono::milliseconds(60000), &wait)) {
+            Log::info("Move complete after ", wait.elapsed_ns / 1000000, "ms (predicted ", wait.predicted_ns / 1000000, "ms, ", wait.reads, " reads)");
+        } else {
+            Log::warning("Move did not complete");
+        }
     }
 
-    std::cout << "Motor controll sequence finished" << std::endl;
+    Log::info("Motor controll sequence finished");
     return 0;
 }
\ No newline at end of file
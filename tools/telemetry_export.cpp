@@ -0,0 +1,134 @@
+// Exports rows of a Telemetry recording as CSV.
+//
+//   telemetry_export <file> [--from <s>] [--to <s>] [--source <name>]
+//
+// Times are seconds since recording started. The file can be read while it is being
+// recorded; rows overwritten by the recorder while they were being read are left out.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Telemetry.h"
+
+using namespace Telemetry;
+
+template <typename T>
+static const T *column(const Header *header, Column column) {
+    return reinterpret_cast<const T *>(reinterpret_cast<const char *>(header) + header->column_offsets[(size_t)column]);
+}
+
+static int usage() {
+    fprintf(stderr, "usage: telemetry_export <file> [--from <s>] [--to <s>] [--source <name>]\n");
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        return usage();
+    }
+
+    double from_s = 0;
+    double to_s = -1;
+    const char *source_name = nullptr;
+
+    for (int i = 2; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            return usage();
+        } else if (strcmp(argv[i], "--from") == 0) {
+            from_s = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--to") == 0) {
+            to_s = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "--source") == 0) {
+            source_name = argv[i + 1];
+        } else {
+            return usage();
+        }
+    }
+
+    int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+    struct stat info;
+
+    if (fd == -1 || fstat(fd, &info) == -1) {
+        fprintf(stderr, "Couldn't open %s\n", argv[1]);
+        return 1;
+    }
+
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Couldn't map %s\n", argv[1]);
+        return 1;
+    }
+
+    const Header *header = static_cast<const Header *>(data);
+    if (!valid(*header, info.st_size)) {
+        fprintf(stderr, "%s is not a telemetry recording of this version\n", argv[1]);
+        return 1;
+    }
+
+    int source_filter = -1;
+    if (source_name) {
+        for (uint32_t i = 0; i < header->source_count; i++) {
+            if (strncmp(header->sources[i].name, source_name, SOURCE_NAME_SIZE) == 0) {
+                source_filter = i;
+            }
+        }
+
+        if (source_filter == -1) {
+            fprintf(stderr, "No source named %s\n", source_name);
+            return 1;
+        }
+    }
+
+    const uint64_t *times = column<uint64_t>(header, Column::TIME);
+    const uint16_t *sources = column<uint16_t>(header, Column::SOURCE);
+    const uint8_t *kinds = column<uint8_t>(header, Column::KIND);
+    const uint8_t *flags = column<uint8_t>(header, Column::FLAGS);
+    const int32_t *as = column<int32_t>(header, Column::A);
+    const int32_t *bs = column<int32_t>(header, Column::B);
+
+    const uint64_t capacity = header->capacity;
+    uint64_t rows = header->rows.load(std::memory_order_acquire);
+    uint64_t first = rows > capacity ? rows - capacity : 0;
+
+    printf("time_s,source,device,kind,a,b,flags\n");
+
+    for (uint64_t row = first; row < rows; row++) {
+        uint64_t index = row % capacity;
+
+        uint64_t time_ns = times[index];
+        uint16_t source = sources[index];
+        uint8_t kind = kinds[index];
+        uint8_t row_flags = flags[index];
+        int32_t a = as[index];
+        int32_t b = bs[index];
+
+        // The recorder may have lapped the reader while the row was copied
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->writing.load(std::memory_order_relaxed) > row + capacity) {
+            continue;
+        }
+
+        double time_s = (double)(int64_t)(time_ns - header->start_ns) / 1e9;
+        if (time_s < from_s || (to_s >= 0 && time_s > to_s) || (source_filter != -1 && source != source_filter)) {
+            continue;
+        }
+
+        const char *name = source < header->source_count ? header->sources[source].name : "?";
+        std::string bounded(name, strnlen(name, SOURCE_NAME_SIZE));
+        const char *device = source < header->source_count ? deviceName(header->sources[source].device) : "?";
+
+        printf("%.9f,%s,%s,%s,%d,%d,%u\n", time_s, bounded.c_str(), device, kindName((Kind)kind), a, b, row_flags);
+    }
+
+    munmap(data, info.st_size);
+    return 0;
+}